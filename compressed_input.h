@@ -0,0 +1,433 @@
+//
+// compressed_input.h
+//
+// Recognize gzip- and zlib-compressed node lists and inflate them a piece at a time
+//
+// (c)2023 Mark J Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+#include <iostream>
+
+// does this input start like a gzip file? (RFC 1952, deflate only)
+bool is_gzip(const unsigned char* _first, const unsigned char* _last) {
+  return _last - _first >= 18 and _first[0] == 0x1f and _first[1] == 0x8b and _first[2] == 8;
+}
+
+// does this input start like a zlib stream? (RFC 1950, deflate with a 32k window at most)
+// the header check rejects text whose second character is a digit, lowercase letter or space
+bool is_zlib(const unsigned char* _first, const unsigned char* _last) {
+  return _last - _first >= 6 and (_first[0] & 0x0f) == 8 and (_first[0] >> 4) <= 7 and
+         (_first[0]*256 + _first[1]) % 31 == 0 and not (_first[1] & 0x20);
+}
+
+//
+// lodepng's inflate only works on a whole stream in memory, and an archive can
+// inflate to many gigabytes, so this is a separate DEFLATE (RFC 1951) decoder
+// that keeps its place between calls: each call to read fills one buffer of text
+// for the parser, pulling compressed bytes from a source only as they are needed.
+// Memory use is the 32k history window and one block of input, whatever the size
+// of the stream. Huffman codes of up to 10 bits are decoded with one table lookup,
+// longer ones a bit at a time.
+//
+struct inflate_stream_t {
+
+  // the source fills a buffer with up to n more compressed bytes, 0 at the end
+  using source_t = std::function<size_t(unsigned char*, size_t)>;
+
+  inflate_stream_t(source_t _source) : source(std::move(_source)), input(input_size), window(window_size) {}
+
+  // inflate up to _n more bytes of text into _out, return how many; 0 at the end of
+  // the stream, or after an error (then error() says what it was)
+  size_t read(char* const _out, const size_t _n) {
+    unsigned char* const out = (unsigned char*)_out;
+    size_t k = 0;
+    size_t summed = 0;
+
+    // one byte of text, also kept in the window for later matches
+    auto put = [&](const unsigned char _b) {
+      window[wpos++ & window_mask] = _b;
+      out[k++] = _b;
+    };
+
+    while (k < _n and stage != stage_t::done and not err) {
+      switch (stage) {
+
+      case stage_t::header:
+        read_header();
+        stage = stage_t::block;
+        break;
+
+      case stage_t::block:
+        if (last_block) {
+          stage = stage_t::trailer;
+          break;
+        }
+        last_block = bits(1);
+        switch (bits(2)) {
+        case 0: {
+          drop(bitcnt % 8);
+          const uint32_t len = bits(16);
+          if ((len ^ bits(16)) != 0xffff) fail("stored block length is damaged");
+          stored_left = len;
+          stage = stage_t::stored;
+          } break;
+        case 1:
+          fixed_codes();
+          stage = stage_t::codes;
+          break;
+        case 2:
+          dynamic_codes();
+          stage = stage_t::codes;
+          break;
+        default:
+          fail("unknown block type");
+        }
+        break;
+
+      case stage_t::stored:
+        while (stored_left > 0 and k < _n and not err) {
+          put((unsigned char)bits(8));
+          --stored_left;
+        }
+        if (stored_left == 0) stage = stage_t::block;
+        break;
+
+      case stage_t::codes:
+        while (k < _n and not err) {
+          // the rest of a match that did not fit in the last buffer
+          if (copy_left > 0) {
+            for (; copy_left > 0 and k < _n; --copy_left) put(window[(wpos - copy_dist) & window_mask]);
+            continue;
+          }
+
+          const int sym = decode(litlen);
+          if (sym < 256) {
+            put((unsigned char)sym);
+          } else if (sym == 256) {
+            stage = stage_t::block;
+            break;
+          } else if (sym < 286) {
+            copy_left = len_base[sym-257] + bits(len_extra[sym-257]);
+            const int dsym = decode(dist);
+            if (dsym < 0 or dsym >= 30) {
+              fail("bad distance code");
+              break;
+            }
+            copy_dist = dist_base[dsym] + bits(dist_extra[dsym]);
+            if (copy_dist > wpos) fail("match reaches back before the start of the text");
+          } else {
+            fail("bad length code");
+          }
+        }
+        break;
+
+      case stage_t::trailer:
+        add_checksum(out + summed, k - summed);
+        summed = k;
+        read_trailer();
+        stage = stage_t::done;
+        break;
+
+      case stage_t::done:
+        break;
+      }
+    }
+
+    add_checksum(out + summed, k - summed);
+    if (err) return 0;
+    return k;
+  }
+
+  // what went wrong, or nullptr
+  const char* error() const { return err; }
+
+private:
+  enum class stage_t { header, block, stored, codes, trailer, done };
+
+  // a canonical Huffman code: the number of codes of each length and the symbols
+  // in code order, plus a table of (symbol << 4 | length) for codes of up to
+  // fast_bits, indexed by the next fast_bits of input (0 for a longer code)
+  static constexpr int fast_bits = 10;
+  struct huffman_t {
+    uint16_t count[16];
+    uint16_t symbol[288];
+    uint16_t fast[1 << fast_bits];
+  };
+
+  static constexpr size_t input_size = 1 << 16;
+  static constexpr size_t window_size = 1 << 15;
+  static constexpr size_t window_mask = window_size - 1;
+
+  static constexpr uint16_t len_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                            35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+  static constexpr uint8_t len_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                            3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+  static constexpr uint16_t dist_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                             257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                             8193, 12289, 16385, 24577};
+  static constexpr uint8_t dist_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                             7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+  void fail(const char* _why) {
+    if (not err) err = _why;
+  }
+
+  // make sure the bit buffer holds at least _n bits; past the end of the input it
+  // is padded with zero bytes, so that a short code can be looked up with a full
+  // window of bits, but using any of those bits is an error (see drop)
+  void need(const int _n) {
+    while (bitcnt < _n) {
+      if (inpos == inlen) {
+        inpos = 0;
+        inlen = at_end ? 0 : source(input.data(), input.size());
+        if (inlen == 0) {
+          at_end = true;
+          if (++padded > 8) fail("compressed input is truncated");
+          bitcnt += 8;
+          continue;
+        }
+      }
+      bitbuf |= (uint64_t)input[inpos++] << bitcnt;
+      bitcnt += 8;
+    }
+  }
+
+  void drop(const int _n) {
+    bitbuf >>= _n;
+    bitcnt -= _n;
+    if (padded > 0 and bitcnt < 8*padded) fail("compressed input is truncated");
+  }
+
+  uint32_t bits(const int _n) {
+    if (_n == 0) return 0;
+    need(_n);
+    const uint32_t val = (uint32_t)(bitbuf & ((1u << _n) - 1));
+    drop(_n);
+    return val;
+  }
+
+  // build a code from the length of each symbol's code (0 for an unused symbol),
+  // false if the lengths are over-subscribed
+  static bool build(huffman_t& _h, const uint8_t* const _lens, const int _n) {
+    std::fill(_h.count, _h.count + 16, 0);
+    for (int s=0; s<_n; ++s) _h.count[_lens[s]]++;
+    _h.count[0] = 0;
+    int left = 1;
+    for (int len=1; len<16; ++len) {
+      left = 2*left - _h.count[len];
+      if (left < 0) return false;
+    }
+
+    int offset[16];
+    int next_code[16];
+    offset[1] = 0;
+    next_code[1] = 0;
+    for (int len=1; len<15; ++len) {
+      offset[len+1] = offset[len] + _h.count[len];
+      next_code[len+1] = (next_code[len] + _h.count[len]) << 1;
+    }
+
+    std::fill(_h.fast, _h.fast + (1 << fast_bits), 0);
+    for (int s=0; s<_n; ++s) {
+      const int len = _lens[s];
+      if (len == 0) continue;
+      _h.symbol[offset[len]++] = (uint16_t)s;
+      if (len > fast_bits) continue;
+      // codes are sent from their top bit down, so the table is indexed by the reversed code
+      int code = next_code[len]++;
+      int rev = 0;
+      for (int b=0; b<len; ++b, code >>= 1) rev = (rev << 1) | (code & 1);
+      for (int i = rev; i < (1 << fast_bits); i += (1 << len)) _h.fast[i] = (uint16_t)(s << 4 | len);
+    }
+    return true;
+  }
+
+  // the next symbol in a code, or -1
+  int decode(const huffman_t& _h) {
+    need(15);
+    const uint16_t e = _h.fast[bitbuf & ((1 << fast_bits) - 1)];
+    if (e) {
+      drop(e & 15);
+      return e >> 4;
+    }
+    // a longer code, one bit at a time (as in zlib's puff)
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for (int len=1; len<16; ++len) {
+      code |= (int)(bitbuf >> (len-1)) & 1;
+      const int count = _h.count[len];
+      if (code - count < first) {
+        drop(len);
+        return _h.symbol[index + (code - first)];
+      }
+      index += count;
+      first = (first + count) << 1;
+      code <<= 1;
+    }
+    fail("bad Huffman code");
+    return -1;
+  }
+
+  void fixed_codes() {
+    uint8_t lens[288];
+    std::fill(lens, lens + 144, 8);
+    std::fill(lens + 144, lens + 256, 9);
+    std::fill(lens + 256, lens + 280, 7);
+    std::fill(lens + 280, lens + 288, 8);
+    build(litlen, lens, 288);
+    std::fill(lens, lens + 30, 5);
+    build(dist, lens, 30);
+  }
+
+  void dynamic_codes() {
+    const int nlen = bits(5) + 257;
+    const int ndist = bits(5) + 1;
+    const int ncode = bits(4) + 4;
+    if (nlen > 286 or ndist > 30) {
+      fail("bad code counts");
+      return;
+    }
+
+    // the code for the code lengths
+    static const uint8_t order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+    uint8_t lens[286+30] = {0};
+    for (int i=0; i<ncode; ++i) lens[order[i]] = (uint8_t)bits(3);
+    huffman_t lencode;
+    if (not build(lencode, lens, 19)) {
+      fail("bad code length code");
+      return;
+    }
+
+    // then the lengths of both codes, with runs
+    std::fill(lens, lens + 19, 0);
+    for (int i=0; i<nlen+ndist and not err; ) {
+      const int sym = decode(lencode);
+      if (sym < 0) return;
+      if (sym < 16) {
+        lens[i++] = (uint8_t)sym;
+        continue;
+      }
+      uint8_t len = 0;
+      int rep = 0;
+      if (sym == 16) {
+        if (i == 0) {
+          fail("repeats a length before the first one");
+          return;
+        }
+        len = lens[i-1];
+        rep = 3 + bits(2);
+      } else if (sym == 17) {
+        rep = 3 + bits(3);
+      } else {
+        rep = 11 + bits(7);
+      }
+      if (i + rep > nlen + ndist) {
+        fail("code lengths run past the end");
+        return;
+      }
+      for (; rep > 0; --rep) lens[i++] = len;
+    }
+    if (err) return;
+    if (lens[256] == 0) fail("no end-of-block code");
+    if (not build(litlen, lens, nlen) or not build(dist, lens + nlen, ndist)) fail("bad Huffman code lengths");
+  }
+
+  void read_header() {
+    const uint32_t id = bits(8);
+    const uint32_t flags = bits(8);
+    if (id == 0x1f and flags == 0x8b) {
+      gzip = true;
+      if (bits(8) != 8) fail("gzip stream is not deflated");
+      const uint32_t flg = bits(8);
+      for (int i=0; i<6; ++i) bits(8);				// time, extra flags, os
+      if (flg & 4) for (uint32_t n = bits(16); n > 0 and not err; --n) bits(8);	// extra field
+      if (flg & 8) while (bits(8) != 0 and not err) {}		// original file name
+      if (flg & 16) while (bits(8) != 0 and not err) {}		// comment
+      if (flg & 2) bits(16);					// header crc
+    } else if ((id & 0x0f) != 8 or (id*256 + flags) % 31 != 0 or (flags & 0x20)) {
+      fail("not a zlib stream");
+    }
+  }
+
+  void read_trailer() {
+    drop(bitcnt % 8);
+    uint32_t sum = 0;
+    if (gzip) {
+      for (int i=0; i<4; ++i) sum |= bits(8) << (8*i);
+      uint32_t size = 0;
+      for (int i=0; i<4; ++i) size |= bits(8) << (8*i);
+      if (not err and (sum != ~crc or size != (uint32_t)wpos)) {
+        std::cout << "Compressed nodelist does not match its checksum, it may be damaged" << std::endl;
+      } else if (not err and (bitcnt > 8*padded or inpos < inlen or source(input.data(), 1) > 0)) {
+        std::cout << "Compressed nodelist holds several gzip members, only the first is read" << std::endl;
+      }
+    } else {
+      for (int i=0; i<4; ++i) sum = (sum << 8) | bits(8);
+      if (not err and sum != ((adler_b << 16) | adler_a)) {
+        std::cout << "Compressed nodelist does not match its checksum, it may be damaged" << std::endl;
+      }
+    }
+  }
+
+  // fold more text into the checksum of the stream's format
+  void add_checksum(const unsigned char* _p, size_t _n) {
+    if (gzip) {
+      static const std::array<uint32_t,256> table = [] {
+        std::array<uint32_t,256> t;
+        for (uint32_t i=0; i<256; ++i) {
+          uint32_t c = i;
+          for (int b=0; b<8; ++b) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+          t[i] = c;
+        }
+        return t;
+      }();
+      for (; _n > 0; --_n) crc = table[(crc ^ *_p++) & 0xff] ^ (crc >> 8);
+    } else {
+      // in runs short enough that the sums can't overflow before the modulo
+      while (_n > 0) {
+        const size_t run = std::min<size_t>(_n, 5552);
+        for (size_t i=0; i<run; ++i) {
+          adler_a += *_p++;
+          adler_b += adler_a;
+        }
+        adler_a %= 65521;
+        adler_b %= 65521;
+        _n -= run;
+      }
+    }
+  }
+
+  source_t source;
+  std::vector<unsigned char> input;
+  size_t inpos = 0;
+  size_t inlen = 0;
+  bool at_end = false;
+  int padded = 0;			// zero bytes put in the bit buffer past the end
+  uint64_t bitbuf = 0;
+  int bitcnt = 0;
+
+  stage_t stage = stage_t::header;
+  bool gzip = false;
+  bool last_block = false;
+  uint32_t stored_left = 0;
+  huffman_t litlen;
+  huffman_t dist;
+  int copy_left = 0;
+  size_t copy_dist = 0;
+
+  std::vector<unsigned char> window;	// the last 32k of text, for matches
+  size_t wpos = 0;			// and how much text there has been
+  uint32_t crc = 0xffffffffu;
+  uint32_t adler_a = 1;
+  uint32_t adler_b = 0;
+  const char* err = nullptr;
+};
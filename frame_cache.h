@@ -0,0 +1,180 @@
+//
+// frame_cache.h
+//
+// Compact binary snapshots of parsed frames, for re-rendering without re-parsing
+//
+// (c)2023 Mark J Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include "switchboard.h"
+#include "hostlist.h"
+
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+
+//
+// Layout (native byte order, every field 4-byte aligned so the file can be
+// walked in place once it is memory-mapped):
+//
+//   header: "swbcache", uint32 version, uint32 n, machine names (n bytes, comma-separated, padded to 4),
+//     then the number of nodes of each machine (one uint32 per name)
+//   then any number of frames, until the end of the file:
+//     uint32 n, frame name (n bytes, padded to 4), uint32 njobs, then per job:
+//       int32 jobid, uint32 machine, uint32 nranges, nranges x (int32 first, int32 last)
+//
+// Frames are appended one at a time, so a cache can be written while drawing
+// and a partly-written one is still readable up to its last whole frame. A cache
+// is only drawn on machines with the same names and node counts, since its node
+// ranges are indexes into each machine's node table.
+//
+
+const char frame_cache_magic[8] = {'s','w','b','c','a','c','h','e'};
+const uint32_t frame_cache_version = 3;
+
+// write frames to a new cache file
+struct frame_cache_writer_t {
+
+  frame_cache_writer_t(const std::string& _fn, const std::string& _machname, const std::vector<int>& _nnodes) {
+    fp = std::fopen(_fn.c_str(), "wb");
+    if (not fp) return;
+    std::fwrite(frame_cache_magic, 1, sizeof(frame_cache_magic), fp);
+    put_u32(frame_cache_version);
+    put_string(_machname);
+    for (const int n : _nnodes) put_u32((uint32_t)n);
+  }
+
+  ~frame_cache_writer_t() {
+    if (fp) std::fclose(fp);
+  }
+
+  frame_cache_writer_t(const frame_cache_writer_t&) = delete;
+  frame_cache_writer_t& operator=(const frame_cache_writer_t&) = delete;
+
+  bool is_open() const { return fp != nullptr; }
+
+  void write(const frame_t& _frame) {
+    put_string(_frame.name);
+    put_u32(_frame.jobs.size());
+    for (const auto& job : _frame.jobs) {
+      put_u32((uint32_t)job.jobid);
+      put_u32((uint32_t)job.machine);
+      const node_set_t& nodes = job.nodes();
+      put_u32(nodes.size());
+      static_assert(sizeof(node_range_t) == 8, "node ranges must be two packed int32");
+      std::fwrite(nodes.data(), sizeof(node_range_t), nodes.size(), fp);
+    }
+  }
+
+private:
+  void put_u32(const uint32_t _val) {
+    std::fwrite(&_val, sizeof(_val), 1, fp);
+  }
+
+  void put_string(const std::string& _str) {
+    static const char zeros[4] = {0, 0, 0, 0};
+    put_u32(_str.size());
+    std::fwrite(_str.data(), 1, _str.size(), fp);
+    std::fwrite(zeros, 1, (4 - _str.size()%4) % 4, fp);
+  }
+
+  FILE* fp = nullptr;
+};
+
+// does this input start like a frame cache?
+bool is_frame_cache(const char* _first, const char* _last) {
+  return (size_t)(_last - _first) >= sizeof(frame_cache_magic) and
+         std::memcmp(_first, frame_cache_magic, sizeof(frame_cache_magic)) == 0;
+}
+
+// walk a (mapped) cache and hand each frame to _on_frame, return false if the
+// cache can't be used; a partly-written last frame is skipped
+bool read_frame_cache(const char* const _first, const char* const _last,
+                      const std::string& _machname, const std::vector<int>& _nnodes,
+                      std::function<void(frame_t&&)> _on_frame) {
+
+  const char* p = _first + sizeof(frame_cache_magic);
+
+  // pull one field, false if the cache ends first
+  auto get_u32 = [&](uint32_t& _val) {
+    if (_last - p < 4) return false;
+    std::memcpy(&_val, p, 4);
+    p += 4;
+    return true;
+  };
+  auto get_string = [&](std::string& _str) {
+    uint32_t len;
+    if (not get_u32(len)) return false;
+    const size_t padded = len + (4 - len%4) % 4;
+    if ((size_t)(_last - p) < padded) return false;
+    _str.assign(p, len);
+    p += padded;
+    return true;
+  };
+
+  uint32_t version;
+  std::string machname;
+  if (not get_u32(version) or version != frame_cache_version) {
+    std::cout << "Frame cache version is not " << frame_cache_version << std::endl;
+    return false;
+  }
+  if (not get_string(machname) or machname != _machname) {
+    std::cout << "Frame cache is for machines " << machname << ", not " << _machname << std::endl;
+    return false;
+  }
+  const uint32_t nmachines = std::count(machname.begin(), machname.end(), ',') + 1;
+  for (uint32_t m=0; m<nmachines; ++m) {
+    uint32_t nnodes;
+    if (not get_u32(nnodes) or m >= _nnodes.size() or nnodes != (uint32_t)_nnodes[m]) {
+      std::cout << "Frame cache is for machines with other node counts, parse the node list again" << std::endl;
+      return false;
+    }
+  }
+
+  frame_t frame;
+  while (p != _last) {
+    uint32_t njobs;
+    if (not get_string(frame.name) or not get_u32(njobs)) break;
+    if ((size_t)(_last - p) / 12 < njobs) break;
+
+    frame.jobs.resize(njobs);
+    bool whole = true;
+    for (auto& job : frame.jobs) {
+      uint32_t jobid, machine, nranges;
+      if (not get_u32(jobid) or not get_u32(machine) or not get_u32(nranges) or machine >= nmachines or
+          (size_t)(_last - p) / sizeof(node_range_t) < nranges) {
+        whole = false;
+        break;
+      }
+      job.jobid = (int)jobid;
+      job.machine = (int)machine;
+      node_set_t nodes((const node_range_t*)p, (const node_range_t*)p + nranges);
+      p += nranges*sizeof(node_range_t);
+
+      // every range must be a run of nodes on its machine
+      for (const auto& range : nodes) {
+        if (range.first < 0 or range.first > range.last or range.last >= _nnodes[machine]) whole = false;
+      }
+      if (not whole) {
+        std::cout << "Frame cache has a node range outside of its machine" << std::endl;
+        break;
+      }
+      job.hostlist = std::make_shared<const hostlist_t>(std::move(nodes));
+    }
+    if (not whole) break;
+
+    std::cout << "Read frame " << frame.name << " with " << njobs << " jobs from cache" << std::endl;
+    _on_frame(std::move(frame));
+    frame.jobs.clear();
+  }
+
+  if (p != _last) std::cout << "Frame cache ends in the middle of a frame" << std::endl;
+  return true;
+}
@@ -0,0 +1,179 @@
+//
+// frame_index.h
+//
+// Sidecar index of where each frame starts in a node list archive, with
+// periodic checkpoints of the color palette, for jumping straight to a frame
+//
+// (c)2023 Mark J Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include "switchboard.h"
+#include "hostlist.h"
+#include "ryb_autocolor.h"
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+//
+// Layout (native byte order):
+//
+//   header: "swbindex", uint32 version, uint32 checkpoint stride
+//   then one entry per frame, in order:
+//     uint64 byte offset of the frame's file keyword (0 for a leading unnamed frame)
+//     int32 next jobid at that offset, uint32 n, frame name (n bytes)
+//     uint8 has checkpoint, and if so the color state before this frame was drawn:
+//       uint8 rng started, uint32 n, rng state (n bytes of text, from operator<<),
+//       uint32 n, n x (int32 jobid, 4 x float32)
+//
+
+const char frame_index_magic[8] = {'s','w','b','i','n','d','e','x'};
+const uint32_t frame_index_version = 2;
+
+struct frame_index_entry_t {
+  size_t offset;
+  int jobid;
+  std::string name;
+  std::unique_ptr<color_state_t> colors;	// only on every stride-th frame
+};
+
+// write one entry per frame as the frames are drawn
+struct frame_index_writer_t {
+
+  frame_index_writer_t(const std::string& _fn, const int _stride) : stride(std::max(1, _stride)) {
+    fp = std::fopen(_fn.c_str(), "wb");
+    if (not fp) return;
+    std::fwrite(frame_index_magic, 1, sizeof(frame_index_magic), fp);
+    put(frame_index_version);
+    put((uint32_t)stride);
+  }
+
+  ~frame_index_writer_t() {
+    if (fp) std::fclose(fp);
+  }
+
+  frame_index_writer_t(const frame_index_writer_t&) = delete;
+  frame_index_writer_t& operator=(const frame_index_writer_t&) = delete;
+
+  bool is_open() const { return fp != nullptr; }
+
+  // call with each frame, in order, before any of its colors are chosen
+  void add(const frame_t& _frame) {
+    put((uint64_t)_frame.offset);
+    put((int32_t)_frame.offset_jobid);
+    put((uint32_t)_frame.name.size());
+    std::fwrite(_frame.name.data(), 1, _frame.name.size(), fp);
+
+    const uint8_t checkpoint = (nframes % stride == 0);
+    put(checkpoint);
+    if (checkpoint) {
+      put((uint8_t)color_rng_started);
+      const std::string rng_state = get_rng_state();
+      put((uint32_t)rng_state.size());
+      std::fwrite(rng_state.data(), 1, rng_state.size(), fp);
+      put((uint32_t)job_to_xyz.size());
+      for (const auto& entry : job_to_xyz) {
+        put((int32_t)entry.first);
+        std::fwrite(entry.second.data(), sizeof(float), 4, fp);
+      }
+    }
+    ++nframes;
+  }
+
+private:
+  template <class T>
+  void put(const T _val) {
+    std::fwrite(&_val, sizeof(T), 1, fp);
+  }
+
+  FILE* fp = nullptr;
+  int stride;
+  int nframes = 0;
+};
+
+// read a whole index, return an empty list if it can't be used
+std::vector<frame_index_entry_t> read_frame_index(const std::string& _fn) {
+  std::vector<frame_index_entry_t> entries;
+
+  FILE* fp = std::fopen(_fn.c_str(), "rb");
+  if (not fp) {
+    std::cout << "Could not open frame index " << _fn << std::endl;
+    return entries;
+  }
+
+  auto get = [fp](auto& _val) { return std::fread(&_val, sizeof(_val), 1, fp) == 1; };
+
+  char magic[sizeof(frame_index_magic)];
+  uint32_t version, stride;
+  if (std::fread(magic, 1, sizeof(magic), fp) != sizeof(magic) or
+      std::memcmp(magic, frame_index_magic, sizeof(magic)) != 0 or
+      not get(version) or version != frame_index_version or not get(stride)) {
+    std::cout << "File " << _fn << " is not a version " << frame_index_version << " frame index" << std::endl;
+    std::fclose(fp);
+    return entries;
+  }
+
+  while (true) {
+    frame_index_entry_t entry;
+    uint64_t offset;
+    int32_t jobid;
+    uint32_t len;
+    uint8_t checkpoint;
+    if (not get(offset) or not get(jobid) or not get(len)) break;
+    entry.offset = offset;
+    entry.jobid = jobid;
+    entry.name.resize(len);
+    if (std::fread(&entry.name[0], 1, len, fp) != len or not get(checkpoint)) break;
+
+    if (checkpoint) {
+      uint8_t started;
+      uint32_t statelen, ncolors;
+      if (not get(started) or not get(statelen)) break;
+      entry.colors = std::make_unique<color_state_t>();
+      entry.colors->rng_started = started;
+      entry.colors->rng_state.resize(statelen);
+      if (std::fread(&entry.colors->rng_state[0], 1, statelen, fp) != statelen or not get(ncolors)) break;
+      bool whole = true;
+      for (uint32_t i=0; i<ncolors and whole; ++i) {
+        int32_t key;
+        std::array<float,4> xyz;
+        whole = get(key) and std::fread(xyz.data(), sizeof(float), 4, fp) == 4;
+        entry.colors->palette[key] = xyz;
+      }
+      if (not whole) break;
+    }
+    entries.push_back(std::move(entry));
+  }
+
+  std::fclose(fp);
+  std::cout << "Read frame index with " << entries.size() << " frames" << std::endl;
+  return entries;
+}
+
+// does an entry belong to this nodelist: at its offset there must be the file keyword
+// and then the frame's name (a leading unnamed frame starts at 0 and has neither)
+bool index_entry_matches(const frame_index_entry_t& _entry, const char* const _first, const char* const _last) {
+  if (_entry.offset == 0) return true;
+  if (_entry.offset >= (size_t)(_last - _first)) return false;
+  const char* p = _first + _entry.offset;
+  if ((size_t)(_last - p) < nextfilekey.size() or std::memcmp(p, nextfilekey.data(), nextfilekey.size()) != 0) return false;
+  p += nextfilekey.size();
+  while (p != _last and is_space(*p)) ++p;
+  const char* const name = p;
+  while (p != _last and not is_space(*p)) ++p;
+  return std::string(name, p) == _entry.name;
+}
+
+// the last checkpointed frame at or before frame _k, or -1 if there is none
+int find_checkpoint(const std::vector<frame_index_entry_t>& _entries, const int _k) {
+  for (int i = std::min(_k, (int)_entries.size()-1); i >= 0; --i) {
+    if (_entries[i].colors) return i;
+  }
+  return -1;
+}
@@ -0,0 +1,377 @@
+//
+// hostlist.h
+//
+// Find and decode slurm hostlist ranges, like "[00002-00054,00056-00087]",
+// or lists of Cray xnames, like "x1000c0s[0-7]b0n[0-1]"
+//
+// (c)2023 Mark J Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include "switchboard.h"
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <iterator>
+#include <unordered_map>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// locale-independent character classes (same sets as std::isspace/isdigit in the "C" locale)
+inline bool is_space(const char _c) {
+  return _c == ' ' or (_c >= '\t' and _c <= '\r');
+}
+inline bool is_digit(const char _c) {
+  return (unsigned char)(_c - '0') < 10;
+}
+inline bool is_hostlist_char(const char _c) {
+  return is_digit(_c) or _c == ',' or _c == '-';
+}
+// and in a list of xnames, which also has the field letters and inner brackets
+inline bool is_xname_char(const char _c) {
+  return is_hostlist_char(_c) or _c == 'x' or _c == 'c' or _c == 's' or _c == 'b' or _c == 'n' or
+         _c == '[' or _c == ']';
+}
+
+//
+// Vector helpers: classify one window of bytes at a time and return a bit
+// mask with one bit per byte, bit i set if byte i matches
+//
+#if defined(__AVX2__)
+const int simd_width = 32;
+inline uint32_t simd_digit_mask(const __m256i _v) {
+  const __m256i d = _mm256_sub_epi8(_v, _mm256_set1_epi8('0'));
+  return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)), d));
+}
+// bytes that are not a digit, comma or dash
+inline uint32_t simd_not_hostlist_mask(const char* _p) {
+  const __m256i v = _mm256_loadu_si256((const __m256i*)_p);
+  const uint32_t sep = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(
+                         _mm256_cmpeq_epi8(v, _mm256_set1_epi8(',')),
+                         _mm256_cmpeq_epi8(v, _mm256_set1_epi8('-'))));
+  return ~(simd_digit_mask(v) | sep);
+}
+// bytes that are not a digit
+inline uint32_t simd_not_digit_mask(const char* _p) {
+  return ~simd_digit_mask(_mm256_loadu_si256((const __m256i*)_p));
+}
+#elif defined(__SSE2__)
+const int simd_width = 16;
+inline uint32_t simd_digit_mask(const __m128i _v) {
+  const __m128i d = _mm_sub_epi8(_v, _mm_set1_epi8('0'));
+  return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d));
+}
+inline uint32_t simd_not_hostlist_mask(const char* _p) {
+  const __m128i v = _mm_loadu_si128((const __m128i*)_p);
+  const uint32_t sep = (uint32_t)_mm_movemask_epi8(_mm_or_si128(
+                         _mm_cmpeq_epi8(v, _mm_set1_epi8(',')),
+                         _mm_cmpeq_epi8(v, _mm_set1_epi8('-'))));
+  return ~(simd_digit_mask(v) | sep) & 0xFFFFu;
+}
+inline uint32_t simd_not_digit_mask(const char* _p) {
+  return ~simd_digit_mask(_mm_loadu_si128((const __m128i*)_p)) & 0xFFFFu;
+}
+#else
+const int simd_width = 0;
+#endif
+
+// return the first byte in [_p,_end) that can not be part of a hostlist body
+const char* find_hostlist_end(const char* _p, const char* const _end) {
+#if defined(__AVX2__) || defined(__SSE2__)
+  while (_end - _p >= simd_width) {
+    const uint32_t stop = simd_not_hostlist_mask(_p);
+    if (stop) return _p + __builtin_ctz(stop);
+    _p += simd_width;
+  }
+#endif
+  while (_p != _end and is_hostlist_char(*_p)) ++_p;
+  return _p;
+}
+
+// convert 1 to 8 ascii digits, starting at _p, to an integer without a loop
+// (8 bytes must be readable at _p, the ones past _n are ignored)
+inline int swar_digits(const char* _p, const int _n) {
+  uint64_t val;
+  std::memcpy(&val, _p, 8);
+  // line the digits up at the top of the word and left-pad with '0'
+  val <<= 8*(8-_n);
+  if (_n < 8) val |= 0x3030303030303030ull >> (8*_n);
+  // combine pairs, then quads, then the two halves
+  val -= 0x3030303030303030ull;
+  val = (val * 10) + (val >> 8);
+  val = (((val & 0x000000FF000000FFull) * 0x000F424000000064ull) +
+         (((val >> 16) & 0x000000FF000000FFull) * 0x0000271000000001ull)) >> 32;
+  return (int)val;
+}
+
+// add one node, or extend the last range up to this one
+inline void add_hostlist_node(node_set_t& _nodes, const int _nodeid, const bool _is_single) {
+  if (_is_single or _nodes.empty()) {
+    // if we're in single mode, start a new range with this one node
+    _nodes.push_back(node_range_t{_nodeid, _nodeid});
+  } else {
+    // the last char was a dash, the range now reaches this node (inclusive)
+    if (_nodeid > _nodes.back().last) _nodes.back().last = _nodeid;
+  }
+}
+
+// add one node number, or after a dash every node from the number before it up
+// to this one; a range of numbers is cut into the runs of the map, since the
+// ids jump wherever the machine's node numbers do
+inline void add_hostlist_number(node_set_t& _nodes, const node_map_t& _map, const int _num,
+                                int& _prev, const bool _is_single) {
+  if (_is_single or _prev < 0) {
+    const int nodeid = _map(_num);
+    _nodes.push_back(node_range_t{nodeid, nodeid});
+  } else {
+    const auto& runs = _map.runs;
+    auto r = std::upper_bound(runs.begin(), runs.end(), _prev,
+                              [](const int n, const node_range_t& run) { return n < run.first; });
+    if (r != runs.begin() and std::prev(r)->last >= _prev) --r;
+    for (; r != runs.end() and r->first <= _num; ++r) {
+      _nodes.push_back(node_range_t{_map.index[std::max(r->first, _prev)], _map.index[std::min(r->last, _num)]});
+    }
+  }
+  _prev = _num;
+}
+
+// sort and merge the ranges and drop the invalid (negative) node ids
+void tidy_node_ranges(node_set_t& _nodes) {
+  std::sort(_nodes.begin(), _nodes.end(),
+            [](const node_range_t& a, const node_range_t& b) { return a.first < b.first; });
+  size_t nkeep = 0;
+  for (auto r : _nodes) {
+    if (r.last < 0) continue;
+    if (r.first < 0) r.first = 0;
+    if (nkeep > 0 and r.first <= _nodes[nkeep-1].last+1) {
+      _nodes[nkeep-1].last = std::max(_nodes[nkeep-1].last, r.last);
+    } else {
+      _nodes[nkeep++] = r;
+    }
+  }
+  _nodes.resize(nkeep);
+}
+
+// decode one hostlist span (everything after the machine name, like "[00002-00054,00056]")
+// and append the 0-indexed node ranges to the set; with SSE2/AVX2 this classifies a
+// whole window of bytes at once and converts each number in the window with SWAR
+// arithmetic, then the scalar loop finishes the tail and any number over 8 digits
+void decode_hostlist(const char* _p, const char* const _end, const node_map_t& _map, node_set_t& _nodes) {
+
+  if (_p != _end and *_p == '[') ++_p;
+  bool is_single = true;
+  int prev = -1;
+
+#if defined(__AVX2__) || defined(__SSE2__)
+  while (_end - _p >= simd_width) {
+    uint32_t rest = simd_not_digit_mask(_p);
+
+    // every number that ends inside this window (and leaves room for an 8-byte load)
+    const int avail = (int)std::min<ptrdiff_t>(_end - _p, simd_width + 8);
+    int i = 0;
+    while (rest) {
+      const int d = __builtin_ctz(rest);
+      const int ndig = d - i;
+      if (ndig > 8 or i + 8 > avail) break;
+      rest &= rest - 1;
+      if (ndig > 0) {
+        add_hostlist_number(_nodes, _map, swar_digits(_p+i, ndig), prev, is_single);
+        is_single = true;
+      }
+      // the delimiter itself: a dash starts a range, anything else (comma or bracket) doesn't
+      if (_p[d] == '-') is_single = false;
+      i = d + 1;
+    }
+
+    // a number longer than the rest of the window (or than 8 digits) is left for the next pass
+    if (i == 0) break;
+    _p += i;
+  }
+#endif
+
+  // finish up one byte at a time
+  while (_p != _end) {
+    if (is_digit(*_p)) {
+      // no machine numbers a node past 2^24 (see machine_t::load), so longer numbers
+      // stop growing there instead of overflowing, and still map to no node
+      int nodeid = 0;
+      while (_p != _end and is_digit(*_p)) nodeid = std::min(nodeid*10 + (*_p++ - '0'), 1 << 24);
+      add_hostlist_number(_nodes, _map, nodeid, prev, is_single);
+      is_single = true;
+    } else {
+      if (*_p == '-') is_single = false;
+      ++_p;
+    }
+  }
+
+  tidy_node_ranges(_nodes);
+}
+
+// return the first byte in [_p,_end) that can not be part of a list of xnames
+const char* find_xname_end(const char* _p, const char* const _end) {
+  while (_p != _end and is_xname_char(*_p)) ++_p;
+  return _p;
+}
+
+// does [_p,_end) (what follows an "x") begin with one whole xname, like 1000c0s[0-7]b0n[0-1]:
+// a cabinet, chassis, slot, board and node, each a number or a bracketed list, and
+// then the end or a comma
+bool is_xname(const char* _p, const char* const _end) {
+  const char letters[5] = {'x', 'c', 's', 'b', 'n'};
+  for (int f=0; f<5; ++f) {
+    if (f > 0) {
+      if (_p == _end or *_p != letters[f]) return false;
+      ++_p;
+    }
+    if (_p != _end and is_digit(*_p)) {
+      while (_p != _end and is_digit(*_p)) ++_p;
+    } else if (_p != _end and *_p == '[') {
+      const char* const open = ++_p;
+      while (_p != _end and is_hostlist_char(*_p)) ++_p;
+      if (_p == open or _p == _end or *_p != ']') return false;
+      ++_p;
+    } else {
+      return false;
+    }
+  }
+  return _p == _end or *_p == ',';
+}
+
+// decode one list of Cray xnames (everything after the first "x", like
+// "1000c0s[0-7]b0n[0-1],x1000c1s0b0n0") and append the node ranges to the set,
+// reading the numbers in place; any field can be a number or a bracketed list,
+// and a node's id counts through its cabinet's place in the map, then its
+// chassis, slot, board and node numbers (see node_map_t)
+void decode_xname_hostlist(const char* _p, const char* const _end, const node_map_t& _map, node_set_t& _nodes) {
+
+  const char letters[5] = {'x', 'c', 's', 'b', 'n'};
+  const int* const count = _map.xname_count;
+  const int ncabinets = (int)_map.index.size();
+
+  // the values of each field of the current item, as ranges
+  node_set_t field[5];
+
+  // read one field's value, false if there isn't one
+  auto read_field = [&](node_set_t& _vals) {
+    _vals.clear();
+    if (_p == _end) return false;
+    if (is_digit(*_p)) {
+      int val = 0;
+      while (_p != _end and is_digit(*_p)) val = val*10 + (*_p++ - '0');
+      _vals.push_back(node_range_t{val, val});
+      return true;
+    }
+    if (*_p != '[') return false;
+    ++_p;
+    bool is_single = true;
+    while (_p != _end and *_p != ']') {
+      if (is_digit(*_p)) {
+        int val = 0;
+        while (_p != _end and is_digit(*_p)) val = val*10 + (*_p++ - '0');
+        add_hostlist_node(_vals, val, is_single);
+        is_single = true;
+      } else if (*_p == '-' or *_p == ',') {
+        is_single = (*_p++ == ',');
+      } else {
+        return false;
+      }
+    }
+    if (_p != _end) ++_p;
+    return not _vals.empty();
+  };
+
+  if (_p != _end and *_p == 'x') ++_p;
+  while (_p != _end) {
+    // one item, like 1000c0s[0-7]b0n[0-1]
+    bool whole = read_field(field[0]);
+    for (int f=1; f<5 and whole; ++f) {
+      whole = (_p != _end and *_p == letters[f]);
+      if (whole) {
+        ++_p;
+        whole = read_field(field[f]);
+      }
+    }
+
+    // every combination of its fields, with each run of node numbers added as one range
+    if (whole) {
+      for (const auto rx : field[0])
+      for (int x = rx.first; x <= std::min(rx.last, ncabinets-1); ++x) {
+        const int cabinet = _map(x);
+        if (cabinet < 0) continue;
+        for (const auto rc : field[1])
+        for (int c = rc.first; c <= std::min(rc.last, count[0]-1); ++c)
+        for (const auto rs : field[2])
+        for (int s = rs.first; s <= std::min(rs.last, count[1]-1); ++s)
+        for (const auto rb : field[3])
+        for (int b = rb.first; b <= std::min(rb.last, count[2]-1); ++b) {
+          const int board = ((cabinet*count[0] + c)*count[1] + s)*count[2] + b;
+          for (const auto rn : field[4]) {
+            const int last = std::min(rn.last, count[3]-1);
+            if (rn.first <= last) _nodes.push_back(node_range_t{board*count[3] + rn.first, board*count[3] + last});
+          }
+        }
+      }
+    }
+
+    // on to the next item (after the rest of this one, if it couldn't be read)
+    while (_p != _end and *_p != ',') ++_p;
+    if (_p != _end) ++_p;
+    if (_p != _end and *_p == 'x') ++_p;
+  }
+
+  tidy_node_ranges(_nodes);
+}
+
+// decode the hostlist after a machine's keyword, however its hosts are named
+void decode_nodes(const char* _p, const char* const _end, const node_map_t& _map, node_set_t& _nodes) {
+  if (_map.xname) decode_xname_hostlist(_p, _end, _map, _nodes);
+  else decode_hostlist(_p, _end, _map, _nodes);
+}
+
+const node_set_t& hostlist_t::nodes() const {
+  std::call_once(decoded, [this] { decode_nodes(text.data(), text.data()+text.size(), *map, set); });
+  return set;
+}
+
+// A running job shows up with the same hostlist in snapshot after snapshot, so
+// remember the hostlist made from each text and hand out the same one every
+// time, until a whole frame goes by without that text appearing. Its nodes only
+// depend on the text, so the jobid isn't part of the key.
+struct hostlist_memo_t {
+
+  // the hostlist for this text, new (and not yet decoded) only if it wasn't in the last frame
+  std::shared_ptr<const hostlist_t> find(const char* _p, const char* const _end, const node_map_t& _map) {
+    auto it = memo.find(std::string_view(_p, _end - _p));
+    if (it == memo.end()) {
+      auto hostlist = std::make_shared<const hostlist_t>(_p, _end, _map);
+      // the key views the text inside the hostlist, which never moves
+      it = memo.emplace(std::string_view(hostlist->text), entry_t{hostlist, frame}).first;
+    }
+    it->second.frame = frame;
+    return it->second.hostlist;
+  }
+
+  // a frame is done: forget the hostlists that were in neither it nor the one before
+  void next_frame() {
+    for (auto it = memo.begin(); it != memo.end(); ) {
+      if (it->second.frame + 1 < frame) it = memo.erase(it);
+      else ++it;
+    }
+    ++frame;
+  }
+
+private:
+  struct entry_t {
+    std::shared_ptr<const hostlist_t> hostlist;
+    unsigned int frame;
+  };
+  std::unordered_map<std::string_view, entry_t> memo;
+  unsigned int frame = 0;
+};
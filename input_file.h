@@ -0,0 +1,264 @@
+//
+// input_file.h
+//
+// Read-only access to the node list input, handed out in pieces
+//
+// (c)2023 Mark J Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include "compressed_input.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+// Regular files are memory-mapped and handed out in large slices so the parser
+// reads the page cache with no copies; stdin ("-"), pipes and fifos are read
+// in blocks as the bytes arrive, so nothing has to land in a temp file first.
+// A file opened to be followed is always read in blocks, so that reading can
+// resume at the old end once wait_for_more says that the file has grown.
+// Gzip and zlib input (other than a followed file) is recognized by its first
+// bytes and inflated one block at a time as the parser asks for more, so that
+// an archive never has to fit in memory once inflated.
+struct input_file_t {
+
+  input_file_t(const std::string& _fn, const bool _follow = false) : path(_fn) {
+    fd = (_fn == "-") ? STDIN_FILENO : ::open(_fn.c_str(), O_RDONLY);
+    if (fd < 0) return;
+
+    struct stat sb;
+    regular = (::fstat(fd, &sb) == 0 and S_ISREG(sb.st_mode));
+    if (regular and sb.st_size > 0 and not _follow) {
+      void* ptr = ::mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (ptr != MAP_FAILED) {
+        // we will walk it front to back, exactly once
+        (void)::madvise(ptr, sb.st_size, MADV_SEQUENTIAL);
+        (void)::madvise(ptr, sb.st_size, MADV_WILLNEED);
+        mapped = static_cast<char*>(ptr);
+        maplen = len = sb.st_size;
+        data = mapped;
+        const unsigned char* head = (const unsigned char*)mapped;
+        if (not is_gzip(head, head + len) and not is_zlib(head, head + len)) return;
+
+        // compressed: read it in blocks instead, to feed the inflater
+        ::munmap(mapped, maplen);
+        mapped = nullptr;
+        data = nullptr;
+        len = 0;
+        (void)::lseek(fd, 0, SEEK_SET);
+        buffer.resize(block_size);
+        start_inflating();
+        return;
+      }
+    }
+
+    // not mappable (pipe, fifo, terminal or empty file): read it in blocks
+    buffer.resize(block_size);
+
+    // but look at the first bytes to see if the stream is compressed; a pipe can
+    // hand over fewer than a header holds, so keep reading until there are enough
+    // to tell, or the input ends
+    if (not _follow) {
+      while (pending < header_size) {
+        const size_t n = read_block(buffer.data() + pending, buffer.size() - pending);
+        if (n == 0) break;
+        pending += n;
+      }
+      const unsigned char* head = (const unsigned char*)buffer.data();
+      if (is_gzip(head, head + pending) or is_zlib(head, head + pending)) {
+        // the bytes already read go to the inflater first
+        sniffed.assign(buffer.begin(), buffer.begin() + pending);
+        pending = 0;
+        start_inflating();
+      }
+    }
+  }
+
+  ~input_file_t() {
+    if (mapped) ::munmap(mapped, maplen);
+    if (fd > STDIN_FILENO) ::close(fd);
+#ifdef __linux__
+    if (watchfd >= 0) ::close(watchfd);
+#endif
+  }
+
+  input_file_t(const input_file_t&) = delete;
+  input_file_t& operator=(const input_file_t&) = delete;
+
+  bool is_open() const { return fd >= 0; }
+
+  // get the next piece of input, return false at the end; the previous
+  // piece is no longer valid once this is called
+  bool next(const char*& _first, const char*& _last) {
+    if (data) {
+      release(data + pos);
+      if (pos == len) return false;
+      const size_t n = std::min(slice_size, len - pos);
+      _first = data + pos;
+      _last = _first + n;
+      pos += n;
+      return true;
+    }
+
+    if (inflater) {
+      const size_t nread = inflater->read(buffer.data(), buffer.size());
+      if (nread == 0) {
+        if (inflater->error() and not inflate_failed) {
+          std::cout << "Could not inflate nodelist: " << inflater->error() << std::endl;
+          inflate_failed = true;
+        }
+        return false;
+      }
+      pos += nread;
+      _first = buffer.data();
+      _last = _first + nread;
+      return true;
+    }
+
+    // the block that was read ahead to look for compression
+    size_t nread = pending;
+    pending = 0;
+    if (nread == 0) nread = read_block(buffer.data(), buffer.size());
+    if (nread == 0) return false;
+    pos += nread;
+    _first = buffer.data();
+    _last = _first + nread;
+    return true;
+  }
+
+  // make the next piece of an in-memory input start at this offset
+  void skip_to(const size_t _offset) {
+    if (data) pos = std::min(_offset, len);
+  }
+
+  // block until a followed file has grown past what next() has returned,
+  // return false if it can't grow any more (not a regular file, or it was
+  // deleted or moved away)
+  bool wait_for_more() {
+    if (not regular or data or inflater) return false;
+
+#ifdef __linux__
+    // watch the file the first time we need to
+    if (watchfd < 0) {
+      watchfd = ::inotify_init1(IN_CLOEXEC);
+      if (watchfd < 0 or ::inotify_add_watch(watchfd, path.c_str(),
+                           IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF) < 0) return false;
+    }
+#endif
+
+    while (true) {
+      // anything new since the last read? (check after the watch is set, so no append is missed)
+      struct stat sb;
+      if (::fstat(fd, &sb) != 0) return false;
+      if ((size_t)sb.st_size > pos) return true;
+      if (sb.st_nlink == 0) return false;
+      if ((size_t)sb.st_size < pos) {
+        // truncated or replaced in place: carry on from its new start
+        std::cout << "Nodelist shrank, following it from the beginning" << std::endl;
+        pos = 0;
+        (void)::lseek(fd, 0, SEEK_SET);
+        continue;
+      }
+
+#ifdef __linux__
+      // sleep until the file changes
+      alignas(struct inotify_event) char events[4096];
+      const ssize_t nread = ::read(watchfd, events, sizeof(events));
+      if (nread < 0 and errno == EINTR) continue;
+      if (nread <= 0) return false;
+      for (const char* e = events; e < events + nread; ) {
+        const struct inotify_event* ev = (const struct inotify_event*)e;
+        if (ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED)) return false;
+        e += sizeof(struct inotify_event) + ev->len;
+      }
+#else
+      // no change notification here, so poll
+      ::sleep(1);
+#endif
+    }
+  }
+
+  // get the whole input at once, if it is mapped (for parsing on several threads)
+  bool whole(const char*& _first, const char*& _last) const {
+    if (not data) return false;
+    _first = data;
+    _last = data + len;
+    return true;
+  }
+
+  // the caller is done with everything before _upto: drop those pages, so
+  // that memory use does not grow with the size of the input
+  void release(const char* _upto) {
+    if (not mapped or data != mapped) return;
+    const size_t page = ::sysconf(_SC_PAGESIZE);
+    const size_t done = ((_upto - mapped) / page) * page;
+    if (done > released) {
+      (void)::madvise(mapped + released, done - released, MADV_DONTNEED);
+      released = done;
+    }
+  }
+
+private:
+
+  // read up to _n bytes from the file, 0 at the end or on an error
+  size_t read_block(char* _buf, const size_t _n) {
+    ssize_t nread;
+    do {
+      nread = ::read(fd, _buf, _n);
+    } while (nread < 0 and errno == EINTR);
+    return nread > 0 ? nread : 0;
+  }
+
+  // hand out inflated text from now on, pulling the compressed bytes from the
+  // ones sniffed for the header and then from the file
+  void start_inflating() {
+    std::cout << "Inflating compressed nodelist as it is read" << std::endl;
+    inflater = std::make_unique<inflate_stream_t>([this](unsigned char* _buf, const size_t _n) {
+      if (sniffpos < sniffed.size()) {
+        const size_t n = std::min(_n, sniffed.size() - sniffpos);
+        std::memcpy(_buf, sniffed.data() + sniffpos, n);
+        sniffpos += n;
+        return n;
+      }
+      return read_block((char*)_buf, _n);
+    });
+  }
+
+  static constexpr size_t slice_size = 16 << 20;
+  static constexpr size_t block_size = 1 << 16;
+  static constexpr size_t header_size = 18;	// enough to recognize gzip or zlib
+
+  std::string path;
+  int fd = -1;
+  bool regular = false;
+#ifdef __linux__
+  int watchfd = -1;
+#endif
+  char* mapped = nullptr;
+  size_t maplen = 0;
+  const char* data = nullptr;		// the mapped text
+  size_t len = 0;
+  size_t pending = 0;			// bytes read ahead into buffer
+  std::vector<char> sniffed;		// compressed bytes read to check the header
+  size_t sniffpos = 0;
+  std::unique_ptr<inflate_stream_t> inflater;
+  bool inflate_failed = false;
+  size_t pos = 0;
+  size_t released = 0;
+  std::vector<char> buffer;
+};
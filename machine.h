@@ -0,0 +1,324 @@
+//
+// machine.h
+//
+// Machine descriptions: the node hierarchy, node numbering and drawing sizes,
+// read from a small text file (or built in) and turned into lookup tables
+//
+// (c)2023 Mark J Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include "switchboard.h"
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+
+//
+// A description is one setting per line, '#' starts a comment:
+//
+//   name frontier              name to look for in the nodelist
+//   levels 128 74 1            number of items in each level of the hierarchy
+//   nodes 1-9088 10113-10496   node numbers, in the order they are drawn
+//   box 5 5                    size of interior of finest block in pixels
+//   per_row 8 15 1             number of items to draw in one row in each level
+//   border 1 1 1               width of drawn border in each level in pixels
+//   gap 2 8 16                 width of white-space gap between items in each level in pixels
+//   outline 1 0 0              which levels have their borders drawn (default: only the nodes)
+//
+// There can be any number of levels (node, chassis, cabinet, row, ...), each one
+// holding items of the one before. The last level's items are laid out in the image.
+// A border that isn't drawn is left as blank space at the right and bottom.
+//
+// Hosts named by Cray xname (x1000c0s0b0n0) instead of by number replace "nodes" with
+//   xname 8 8 2 2              chassis per cabinet, slots per chassis, boards per slot, nodes per board
+//   cabinets 1000-1003 1100    cabinet numbers, in the order they are drawn
+// and the nodes are drawn in xname order: every node of a board, every board of a
+// slot, and so on, so the levels can follow the fields (like "levels 4 8 8 4").
+//
+
+// how many rows are needed?
+int rows_needed(const int _n, const int _nperrow) {
+  return (_n+_nperrow-1)/_nperrow;
+}
+
+// the machines that don't need a file
+const char* const builtin_machines[][2] = {
+  // exascale machine at ORNL
+  {"frontier", "name frontier\n"
+               "levels 128 74 1\n"
+               "nodes 1-9088 10113-10496\n"
+               "box 5 5\n"
+               "per_row 8 15 1\n"
+               "border 1 1 1\n"
+               "gap 2 8 16\n"},
+  {"crusher",  "name crusher\n"
+               "levels 128 2 1\n"
+               "nodes 1-192\n"
+               "box 5 5\n"
+               "per_row 8 2 1\n"
+               "border 1 1 1\n"
+               "gap 2 8 16\n"},
+};
+
+struct machine_t {
+  // as described
+  std::string name;
+  std::vector<int> num_per_level;
+  std::vector<node_range_t> node_numbers;
+  int base_size[2] = {5, 5};
+  std::vector<int> num_per_row;
+  std::vector<int> block_border;
+  std::vector<int> block_gap;
+  std::vector<int> outline;
+  std::vector<int> xname_count;
+  std::vector<node_range_t> cabinets;
+
+  // and compiled from that
+  std::string keyword;			// to look for in the nodelist: the name, or "x" for xnames
+  int nlevels = 0;
+  std::vector<int> total_num;		// total number of items in each level
+  node_map_t map;			// node number to node id
+  std::vector<int> boxszx, boxszy, boxbdr, boxgap, boxwid, boxhgt;
+  int width = 0;			// of the whole image
+  int height = 0;
+  // for each level, the top left pixel of each item's box (outside its border);
+  // level 0 is the nodes, indexed by node id
+  std::vector<std::vector<int>> box_x, box_y;
+
+  // what drawing a frame needs for each node id, as separate arrays: the pixel
+  // index where its filled box starts when drawn inside its border [0] or over
+  // it [1], and how many boxes from it to the end of its row in its group
+  std::vector<int> node_offset[2];
+  std::vector<int> node_run;
+  int node_xwid[2] = {0, 0};		// and the filled box size, the same for every node
+  int node_yhgt[2] = {0, 0};
+
+  // read a description, print what's wrong and return false if it can't be used
+  bool read(std::istream& _is, const std::string& _source) {
+    std::string line;
+    for (int lineno = 1; std::getline(_is, line); ++lineno) {
+      line = line.substr(0, line.find('#'));
+      std::istringstream ss(line);
+      std::string key;
+      if (not (ss >> key)) continue;
+
+      bool ok = true;
+      if (key == "name") {
+        ok = bool(ss >> name);
+      } else if (key == "levels") {
+        ok = read_ints(ss, num_per_level);
+      } else if (key == "nodes") {
+        ok = read_ranges(ss, node_numbers);
+      } else if (key == "xname") {
+        ok = read_ints(ss, xname_count);
+      } else if (key == "cabinets") {
+        ok = read_ranges(ss, cabinets);
+      } else if (key == "box") {
+        ok = bool(ss >> base_size[0] >> base_size[1]);
+      } else if (key == "per_row") {
+        ok = read_ints(ss, num_per_row);
+      } else if (key == "border") {
+        ok = read_ints(ss, block_border);
+      } else if (key == "gap") {
+        ok = read_ints(ss, block_gap);
+      } else if (key == "outline") {
+        ok = read_ints(ss, outline);
+      } else {
+        ok = false;
+      }
+
+      if (not ok) {
+        std::cout << _source << " line " << lineno << ": can't use \"" << line << "\"" << std::endl;
+        return false;
+      }
+    }
+    return compile(_source);
+  }
+
+  // a built-in machine by name, or else a description file
+  bool load(const std::string& _name_or_file) {
+    for (const auto& builtin : builtin_machines) {
+      if (_name_or_file == builtin[0]) {
+        std::istringstream is(builtin[1]);
+        return read(is, _name_or_file);
+      }
+    }
+    std::ifstream is(_name_or_file);
+    if (not is) {
+      std::cout << "No built-in machine or description file called " << _name_or_file << std::endl;
+      return false;
+    }
+    return read(is, _name_or_file);
+  }
+
+private:
+  static bool read_ints(std::istringstream& _ss, std::vector<int>& _vals) {
+    _vals.clear();
+    for (int v; _ss >> v; ) _vals.push_back(v);
+    return _ss.eof() and not _vals.empty();
+  }
+
+  // numbers or ranges like 10113-10496
+  static bool read_ranges(std::istringstream& _ss, std::vector<node_range_t>& _ranges) {
+    _ranges.clear();
+    for (std::string r; _ss >> r; ) {
+      node_range_t nr;
+      size_t used = 0;
+      try {
+        nr.first = nr.last = std::stoi(r, &used);
+        if (used < r.size() and r[used] == '-') {
+          size_t used2 = 0;
+          nr.last = std::stoi(r.substr(used+1), &used2);
+          used += 1 + used2;
+        }
+      } catch (const std::exception&) {
+        used = 0;
+      }
+      if (used != r.size() or nr.first < 0 or nr.last < nr.first) return false;
+      _ranges.push_back(nr);
+    }
+    return true;
+  }
+
+  // number each node (or xname cabinet) in order, every other number maps to -1;
+  // returns how many there are, or -1 if a number is used twice
+  static int number_in_order(const std::vector<node_range_t>& _ranges, node_map_t& _map) {
+    int maxnum = 0;
+    for (const auto& r : _ranges) maxnum = std::max(maxnum, r.last);
+    _map.index.assign(maxnum+1, -1);
+    _map.runs = _ranges;
+    std::sort(_map.runs.begin(), _map.runs.end(),
+              [](const node_range_t& a, const node_range_t& b) { return a.first < b.first; });
+    int num = 0;
+    for (const auto& r : _ranges) {
+      for (int n = r.first; n <= r.last; ++n) {
+        if (_map.index[n] >= 0) return -1;
+        _map.index[n] = num++;
+      }
+    }
+    return num;
+  }
+
+  // check the description and build the tables
+  bool compile(const std::string& _source) {
+    auto fail = [&](const char* _why) {
+      std::cout << _source << ": " << _why << std::endl;
+      return false;
+    };
+
+    nlevels = num_per_level.size();
+    if (name.empty()) return fail("needs a name");
+    if (nlevels < 1) return fail("needs at least one level");
+    if ((int)num_per_row.size() != nlevels or (int)block_border.size() != nlevels or
+        (int)block_gap.size() != nlevels) return fail("needs per_row, border and gap for every level");
+    if (outline.empty()) {
+      outline.assign(nlevels, 0);
+      outline[0] = 1;
+    }
+    if ((int)outline.size() != nlevels) return fail("needs an outline setting for every level");
+    if (xname_count.empty() and not cabinets.empty()) return fail("needs xname counts to go with its cabinets");
+    if (not xname_count.empty()) {
+      if (xname_count.size() != 4) return fail("needs four xname counts: chassis, slots, boards and nodes");
+      if (cabinets.empty()) return fail("needs cabinet numbers");
+      if (not node_numbers.empty()) return fail("can't have node numbers and xnames");
+    } else if (node_numbers.empty()) return fail("needs node numbers");
+    for (int i=0; i<nlevels; ++i) {
+      if (num_per_level[i] < 1 or num_per_row[i] < 1) return fail("needs at least one item per level and row");
+      if (block_border[i] < 0 or block_gap[i] < 0) return fail("can't have negative borders or gaps");
+    }
+    if (base_size[0] < 1 or base_size[1] < 1) return fail("needs a box of at least 1 x 1");
+
+    // number each node in order, or each cabinet, whose nodes then count through the xname fields
+    int nnodes = 0;
+    if (xname_count.empty()) {
+      keyword = name;
+      for (const auto& r : node_numbers) if (r.last >= (1 << 24)) return fail("has node numbers that are too large");
+      nnodes = number_in_order(node_numbers, map);
+      if (nnodes < 0) return fail("lists a node number twice");
+    } else {
+      keyword = "x";	// only where a whole xname starts a word (see is_xname)
+      int64_t per_cabinet = 1;
+      for (int i=0; i<4; ++i) {
+        if (xname_count[i] < 1) return fail("needs at least one of each xname field");
+        per_cabinet *= xname_count[i];
+        map.xname_count[i] = xname_count[i];
+      }
+      for (const auto& r : cabinets) if (r.last >= (1 << 24)) return fail("has cabinet numbers that are too large");
+      const int ncabinets = number_in_order(cabinets, map);
+      if (ncabinets < 0) return fail("lists a cabinet number twice");
+      if (ncabinets * per_cabinet >= (1 << 24)) return fail("has too many nodes");
+      nnodes = ncabinets * per_cabinet;
+      map.xname = true;
+    }
+
+    total_num.assign(nlevels, 0);
+    total_num[0] = nnodes;
+    for (int i=1; i<nlevels; ++i) total_num[i] = rows_needed(total_num[i-1], num_per_level[i-1]);
+    if (total_num[nlevels-1] > num_per_level[nlevels-1]) return fail("has more nodes than its levels hold");
+
+    // set drawing sizes per node/block/image
+    boxszx.assign(nlevels, 0);
+    boxszy.assign(nlevels, 0);
+    boxbdr.assign(nlevels, 0);
+    boxgap.assign(nlevels, 0);
+    boxwid.assign(nlevels, 0);
+    boxhgt.assign(nlevels, 0);
+    for (int i=0; i<nlevels; ++i) {
+      if (i==0) {
+        boxszx[i] = base_size[0];
+        boxszy[i] = base_size[1];
+      } else {
+        boxszx[i] = num_per_row[i-1]*boxwid[i-1];
+        boxszy[i] = rows_needed(num_per_level[i-1],num_per_row[i-1])*boxhgt[i-1];
+      }
+      boxbdr[i] = block_border[i];
+      boxgap[i] = block_gap[i];
+      boxwid[i] = boxgap[i] + 2*boxbdr[i] + boxszx[i];
+      boxhgt[i] = boxgap[i] + 2*boxbdr[i] + boxszy[i];
+    }
+    const int top = nlevels-1;
+    width = num_per_row[top]*boxwid[top];
+    height = rows_needed(num_per_level[top],num_per_row[top])*boxhgt[top];
+
+    // where every item's box goes, from the top level down: at its row and column
+    // inside its parent (just inside the parent's border, if that is drawn)
+    box_x.assign(nlevels, std::vector<int>());
+    box_y.assign(nlevels, std::vector<int>());
+    for (int i=top; i>=0; --i) {
+      box_x[i].resize(total_num[i]);
+      box_y[i].resize(total_num[i]);
+      const int inset = (i < top and outline[i+1]) ? boxbdr[i+1] : 0;
+      for (int k=0; k<total_num[i]; ++k) {
+        const int parent = k / num_per_level[i];
+        const int item = k - parent*num_per_level[i];
+        const int px = (i < top) ? box_x[i+1][parent] + inset : 0;
+        const int py = (i < top) ? box_y[i+1][parent] + inset : 0;
+        box_x[i][k] = px + (item % num_per_row[i])*boxwid[i] + boxgap[i]/2;
+        box_y[i][k] = py + (item / num_per_row[i])*boxhgt[i] + boxgap[i]/2;
+      }
+    }
+
+    for (int m=0; m<2; ++m) {
+      const int bdr = (m == 0) ? boxbdr[0] : 0;
+      node_offset[m].resize(nnodes);
+      for (int k=0; k<nnodes; ++k) node_offset[m][k] = (box_y[0][k] + bdr)*width + box_x[0][k] + bdr;
+      node_xwid[m] = boxszx[0] + (m == 0 ? 0 : 2*boxbdr[0]);
+      node_yhgt[m] = boxszy[0] + (m == 0 ? 0 : 2*boxbdr[0]);
+    }
+    node_run.resize(nnodes);
+    for (int k=0; k<nnodes; ++k) {
+      const int node = k % num_per_level[0];
+      node_run[k] = std::min(num_per_row[0] - node % num_per_row[0], num_per_level[0] - node);
+    }
+
+    std::cout << "Machine " << name << " has " << nnodes << " nodes" << std::endl;
+    return true;
+  }
+};
@@ -0,0 +1,355 @@
+//
+// nodelist_parser.h
+//
+// One-pass lexer that turns squeue-style node list text into frames of jobs
+//
+// (c)2023 Mark J Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include "switchboard.h"
+#include "machine.h"
+#include "hostlist.h"
+
+#include <vector>
+#include <array>
+#include <string>
+#include <functional>
+#include <iostream>
+
+// match one fixed keyword a byte at a time (a small KMP automaton), so that
+// keywords can be found even when they straddle two input buffers
+struct keyword_matcher_t {
+  std::string key;
+  std::vector<int> fail;
+  int matched = 0;
+
+  keyword_matcher_t(const std::string& _key) : key(_key), fail(_key.size(), 0) {
+    for (size_t i=1, k=0; i<key.size(); ++i) {
+      while (k > 0 and key[i] != key[k]) k = fail[k-1];
+      if (key[i] == key[k]) ++k;
+      fail[i] = k;
+    }
+  }
+
+  // returns true if this character completed the keyword
+  bool step(const char _c) {
+    while (matched > 0 and key[matched] != _c) matched = fail[matched-1];
+    if (key[matched] == _c) ++matched;
+    if (matched == (int)key.size()) {
+      matched = 0;
+      return true;
+    }
+    return false;
+  }
+
+  void reset() { matched = 0; }
+};
+
+// match any of several keywords a byte at a time (an Aho-Corasick automaton,
+// flattened into a table with one row of next states per state)
+struct keyword_set_matcher_t {
+  int state = 0;
+
+  keyword_set_matcher_t(const std::vector<std::string>& _keys) {
+    add_state();
+    for (int k=0; k<(int)_keys.size(); ++k) {
+      int s = 0;
+      for (const char c : _keys[k]) {
+        if (table[s][(unsigned char)c] == 0) {
+          const int next = add_state();
+          table[s][(unsigned char)c] = next;
+        }
+        s = table[s][(unsigned char)c];
+      }
+      if (found[s] < 0) found[s] = k;
+    }
+
+    // breadth-first, fill in the missing moves from each state's failure state
+    std::vector<int> fail(table.size(), 0);
+    std::vector<int> queue;
+    for (int c=0; c<256; ++c) if (table[0][c]) queue.push_back(table[0][c]);
+    for (size_t q=0; q<queue.size(); ++q) {
+      const int s = queue[q];
+      if (found[s] < 0) found[s] = found[fail[s]];
+      for (int c=0; c<256; ++c) {
+        const int next = table[s][c];
+        if (next) {
+          fail[next] = table[fail[s]][c];
+          queue.push_back(next);
+        } else {
+          table[s][c] = table[fail[s]][c];
+        }
+      }
+    }
+  }
+
+  // returns the index of the keyword this character completed, or -1
+  int step(const char _c) {
+    state = table[state][(unsigned char)_c];
+    const int k = found[state];
+    if (k >= 0) state = 0;
+    return k;
+  }
+
+  void reset() { state = 0; }
+
+private:
+  int add_state() {
+    table.emplace_back();
+    table.back().fill(0);
+    found.push_back(-1);
+    return (int)table.size() - 1;
+  }
+
+  std::vector<std::array<int,256>> table;
+  std::vector<int> found;		// keyword that ends at each state, or -1
+};
+
+//
+// A resumable state machine over the node list text: bytes can be fed in any
+// number of pieces, each byte is examined once (hostlists twice: once to find
+// their end and once to decode), and completed frames are handed to a callback.
+//
+// The grammar is the one the original search-based parser accepted:
+//   - the first number on each line (after whitespace) is the jobid for the
+//     jobs that follow, lines without one set it to 0
+//   - every occurrence of a machine name starts a job, whose nodes are the
+//     hostlist that immediately follows; the jobid is incremented after each
+//     (for a machine with xnames, an "x" that begins a word, after whitespace or
+//     a comma, and starts a whole xname like x1000c0s0b0n0; any other "x" is text)
+//   - the keyword "file" followed by a name finishes the current frame (if it
+//     has any jobs) and sets the name of the next one
+//
+struct nodelist_parser_t {
+
+  nodelist_parser_t(const std::vector<machine_t>& _machines,
+                    const std::string& _firstname,
+                    std::function<void(frame_t&&)> _on_frame)
+    : machine(machine_names(_machines)), filekey(nextfilekey), machines(_machines),
+      memo(_machines.size()), on_frame(std::move(_on_frame)), nextframename(_firstname) {}
+
+  // Set this parser up to read one piece of a larger input (see parallel_parse.h):
+  // every file keyword hands over a segment, even an empty one, carrying the name
+  // and offset of the keyword before it, and nothing is printed; if the piece begins right
+  // after a newline, start in that state so the first number is read as a jobid
+  void segments_only(const bool _at_line_start, const size_t _offset) {
+    segments = true;
+    base = _offset;
+    if (_at_line_start) state = lex_state::line_start;
+  }
+
+  // start partway into an input, at the beginning of a frame (at a file keyword, or
+  // at the top) that was found there earlier and had _nextjobid at that point
+  void resume_at(const size_t _offset, const int _nextjobid) {
+    base = _offset;
+    nextjobid = _nextjobid;
+    frame.offset = _offset;
+    frame.offset_jobid = _nextjobid;
+  }
+
+  // stop consuming input, for example once the last wanted frame is done
+  void stop() { stopped = true; }
+
+  // consume the next piece of the input
+  void feed(const char* _p, const char* const _end) {
+    const char* const start = _p;
+
+    while (_p != _end and not stopped) {
+      switch (state) {
+
+      case lex_state::scan:
+        // look for a newline or the end of one of the keywords
+        while (_p != _end) {
+          const char c = *_p++;
+          const char before = prevchar;
+          prevchar = c;
+          if (c == '\n') {
+            machine.reset();
+            filekey.reset();
+            state = lex_state::line_start;
+            break;
+          } else if ((jobmachine = machine.step(c)) >= 0) {
+            at_word_start = is_space(before) or before == ',';
+            filekey.reset();
+            token.clear();
+            state = lex_state::host_open;
+            break;
+          } else if (filekey.step(c)) {
+            machine.reset();
+            start_new_frame();
+            // the next frame starts here
+            frame.offset = base + (_p - start) - filekey.key.size();
+            frame.offset_jobid = nextjobid;
+            state = lex_state::file_space;
+            break;
+          }
+        }
+        break;
+
+      case lex_state::line_start:
+        // advance past all whitespace, then a number is the next jobid
+        while (_p != _end and is_space(*_p)) prevchar = *_p++;
+        if (_p != _end) {
+          jobid = 0;
+          state = lex_state::jobid;
+        }
+        break;
+
+      case lex_state::jobid:
+        while (_p != _end and is_digit(*_p)) {
+          prevchar = *_p;
+          jobid = jobid*10 + (*_p++ - '0');
+        }
+        if (_p != _end) {
+          nextjobid = jobid;
+          state = lex_state::scan;
+        }
+        break;
+
+      case lex_state::file_space:
+        while (_p != _end and is_space(*_p)) ++_p;
+        if (_p != _end) {
+          token.clear();
+          state = lex_state::file_name;
+        }
+        break;
+
+      case lex_state::file_name: {
+        const char* first = _p;
+        while (_p != _end and not is_space(*_p)) ++_p;
+        token.append(first, _p);
+        if (_p != _end) {
+          set_frame_name();
+          state = lex_state::scan;
+        }
+        } break;
+
+      case lex_state::host_open:
+        if (machines[jobmachine].map.xname) {
+          // the "x" can only start an xname at the beginning of a word
+          state = at_word_start ? lex_state::host_list : lex_state::scan;
+          break;
+        }
+        // advance only if next character is a [
+        if (*_p == '[') ++_p;
+        state = lex_state::host_list;
+        if (_p == _end) token.push_back('[');
+        break;
+
+      case lex_state::host_list: {
+        // find the end of the hostlist, decode it in place if it is all here
+        const char* first = _p;
+        const bool xname = machines[jobmachine].map.xname;
+        _p = xname ? find_xname_end(_p, _end) : find_hostlist_end(_p, _end);
+        const bool closed = (_p != _end);
+        if (closed and *_p == ']' and not xname) ++_p;
+
+        if (not closed) {
+          token.append(first, _p);
+        } else if (token.empty()) {
+          add_hostlist(first, _p);
+          if (_p != first) prevchar = _p[-1];
+          state = lex_state::scan;
+        } else {
+          token.append(first, _p);
+          add_hostlist(token.data(), token.data()+token.size());
+          prevchar = token.back();
+          state = lex_state::scan;
+        }
+        } break;
+      }
+    }
+
+    base += _end - start;
+  }
+
+  // the input is exhausted: finish any partial token and hand over the last frame
+  void finish() {
+    if ((state == lex_state::host_open and not machines[jobmachine].map.xname) or state == lex_state::host_list) {
+      add_hostlist(token.data(), token.data()+token.size());
+    } else if (state == lex_state::file_name) {
+      set_frame_name();
+    }
+    state = lex_state::scan;
+    machine.reset();
+    filekey.reset();
+
+    // put whatever's on the stack into the last/only frame
+    if (not segments) std::cout << "Finishing last frame with " << frame.jobs.size() << " jobs" << std::endl;
+    frame.name = nextframename;
+    on_frame(std::move(frame));
+    frame.jobs.clear();
+    for (auto& m : memo) m.next_frame();
+  }
+
+  // the frame still being read (with its jobs so far), named as it will be when finished
+  const frame_t& current() {
+    frame.name = nextframename;
+    return frame;
+  }
+
+private:
+  enum class lex_state { scan, line_start, jobid, file_space, file_name, host_open, host_list };
+
+  // if there were jobs, push all of those into a new frame
+  void start_new_frame() {
+    if (not segments) {
+      if (frame.jobs.empty()) return;
+      std::cout << "Finishing frame with " << frame.jobs.size() << " jobs" << std::endl;
+    }
+    frame.name = nextframename;
+    on_frame(std::move(frame));
+    frame.jobs.clear();
+    for (auto& m : memo) m.next_frame();
+  }
+
+  void set_frame_name() {
+    nextframename = token;
+    if (not segments) std::cout << "Read filename (" << nextframename << ")" << std::endl;
+  }
+
+  // a job with the hostlist after a machine's keyword, unless an xname machine's "x"
+  // turns out not to start an xname, which is then just text
+  void add_hostlist(const char* _first, const char* _last) {
+    if (machines[jobmachine].map.xname and not is_xname(_first, _last)) return;
+    add_job(_first, _last);
+  }
+
+  void add_job(const char* _first, const char* _last) {
+    job_t newjob;
+    newjob.jobid = nextjobid;
+    newjob.machine = jobmachine;
+    newjob.hostlist = memo[jobmachine].find(_first, _last, machines[jobmachine].map);
+    frame.jobs.push_back(std::move(newjob));
+
+    // increment jobid in case it isn't given
+    nextjobid++;
+  }
+
+  static std::vector<std::string> machine_names(const std::vector<machine_t>& _machines) {
+    std::vector<std::string> names;
+    for (const auto& m : _machines) names.push_back(m.keyword);
+    return names;
+  }
+
+  keyword_set_matcher_t machine;
+  keyword_matcher_t filekey;
+  const std::vector<machine_t>& machines;
+  std::vector<hostlist_memo_t> memo;	// one per machine, since they map node numbers differently
+  int jobmachine = 0;			// the machine whose name started the current job
+  char prevchar = '\n';			// the byte before the current one, while scanning
+  bool at_word_start = false;		// and whether the keyword began a word
+  std::function<void(frame_t&&)> on_frame;
+
+  lex_state state = lex_state::scan;
+  std::string token;			// partial token carried over between calls to feed
+  int jobid = 0;
+  int nextjobid = 1;
+  std::string nextframename;
+  frame_t frame;
+  size_t base = 0;			// offset of the current piece in the whole input
+  bool segments = false;
+  bool stopped = false;
+};
@@ -0,0 +1,152 @@
+//
+// parallel_parse.h
+//
+// Parse a large in-memory node list on several threads, keeping frame order
+//
+// (c)2023 Mark J Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include "switchboard.h"
+#include "nodelist_parser.h"
+#include "thread_pool.h"
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <functional>
+#include <iostream>
+
+//
+// The input is cut only at the start of a line. There the serial parser has
+// just consumed a newline, so it is in its line_start state no matter what came
+// before: the jobid is re-read from the new line, and no keyword, hostlist or
+// file name can straddle the cut. The one exception is a "file" keyword whose
+// name is on a later line, so a cut is never placed right after one of those.
+//
+// Each piece is parsed into segments (the jobs between two file keywords), and
+// the segments are then replayed in order, with the same rules the serial
+// parser uses to decide when a frame is finished and what it is called.
+//
+
+// is the line starting at _line (just after a newline) a safe place to cut?
+bool safe_to_split(const char* _line, const char* const _first) {
+  // look back past the newline and any other whitespace for a dangling "file"
+  const char* p = _line;
+  while (p != _first and is_space(p[-1])) --p;
+  const size_t klen = nextfilekey.size();
+  return not ((size_t)(p - _first) >= klen and std::memcmp(p - klen, nextfilekey.data(), klen) == 0);
+}
+
+// find a cut at or after _p: the start of a nearby line beginning with the
+// file keyword if there is one, or else just the start of the next line
+const char* find_split(const char* _p, const char* const _first, const char* const _last, const size_t _lookahead) {
+
+  // prefer a frame boundary
+  const std::string marker = "\n" + nextfilekey;
+  const char* const limit = (size_t)(_last - _p) > _lookahead ? _p + _lookahead : _last;
+  for (const char* m = _p; m < limit; ++m) {
+    m = (const char*)memmem(m, _last - m, marker.data(), marker.size());
+    if (not m or m >= limit) break;
+    if (safe_to_split(m+1, _first)) return m+1;
+  }
+
+  // otherwise any line boundary will do
+  for (const char* m = _p; m < _last; ++m) {
+    m = (const char*)std::memchr(m, '\n', _last - m);
+    if (not m) break;
+    if (safe_to_split(m+1, _first)) return m+1;
+  }
+  return _last;
+}
+
+// replay the segments from each piece, in order, as the serial parser would have seen them
+struct segment_merger_t {
+
+  segment_merger_t(const std::string& _firstname, std::function<void(frame_t&&)> _on_frame)
+    : on_frame(std::move(_on_frame)) {
+    frame.name = _firstname;
+  }
+
+  void add(std::vector<frame_t>& _segments) {
+    for (size_t i=0; i<_segments.size(); ++i) {
+      if (i > 0) {
+        // a file keyword came between these two segments
+        if (not frame.jobs.empty()) {
+          std::cout << "Finishing frame with " << frame.jobs.size() << " jobs" << std::endl;
+          on_frame(std::move(frame));
+          frame.jobs.clear();
+        }
+        frame.name = std::move(_segments[i].name);
+        frame.offset = _segments[i].offset;
+        frame.offset_jobid = _segments[i].offset_jobid;
+        std::cout << "Read filename (" << frame.name << ")" << std::endl;
+      }
+      if (frame.jobs.empty()) {
+        frame.jobs = std::move(_segments[i].jobs);
+      } else {
+        for (auto& job : _segments[i].jobs) frame.jobs.push_back(std::move(job));
+      }
+    }
+  }
+
+  void finish() {
+    std::cout << "Finishing last frame with " << frame.jobs.size() << " jobs" << std::endl;
+    on_frame(std::move(frame));
+    frame.jobs.clear();
+  }
+
+private:
+  std::function<void(frame_t&&)> on_frame;
+  frame_t frame;
+};
+
+// parse all of [_first,_last) with the pool, one wave of pieces of about _piece_size
+// bytes at a time, and hand the frames to _on_frame in input order; _done is told
+// how far parsing has gotten
+void parse_in_parallel(const char* const _first, const char* const _last,
+                       thread_pool_t& _pool,
+                       const std::vector<machine_t>& _machines,
+                       const std::string& _firstname,
+                       std::function<void(frame_t&&)> _on_frame,
+                       std::function<void(const char*)> _done,
+                       const size_t _piece_size = 4 << 20) {
+
+  // pieces big enough to amortize the thread handoff, small enough to bound memory
+  const size_t piece_size = _piece_size;
+  const int npieces = 2 * _pool.size();
+
+  segment_merger_t merger(_firstname, std::move(_on_frame));
+  std::vector<const char*> cuts;
+  std::vector<std::vector<frame_t>> segments(npieces);
+
+  for (const char* p = _first; p != _last; ) {
+
+    // choose the cuts for this wave
+    cuts.assign(1, p);
+    while ((int)cuts.size() <= npieces and cuts.back() != _last) {
+      const char* target = (size_t)(_last - cuts.back()) > piece_size ? cuts.back() + piece_size : _last;
+      cuts.push_back(target == _last ? _last : find_split(target, _first, _last, piece_size/2));
+    }
+    const int nwave = (int)cuts.size() - 1;
+
+    // parse those pieces in parallel
+    _pool.parallel_for(nwave, [&](const int i) {
+      segments[i].clear();
+      nodelist_parser_t parser(_machines, _firstname,
+                               [&segments,i](frame_t&& _seg) { segments[i].push_back(std::move(_seg)); });
+      parser.segments_only(cuts[i] != _first, cuts[i] - _first);
+      parser.feed(cuts[i], cuts[i+1]);
+      parser.finish();
+    });
+
+    // and stitch them together in order
+    for (int i=0; i<nwave; ++i) merger.add(segments[i]);
+
+    p = cuts.back();
+    _done(p);
+  }
+
+  merger.finish();
+}
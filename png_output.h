@@ -0,0 +1,107 @@
+//
+// png_output.h
+//
+// Write a frame buffer of palette indexes as a PNG, with its own palette
+//
+// (c)2023 Mark J Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include "render.h"
+#include "thread_pool.h"
+
+#include "lodepng.h"
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+//
+// A frame buffer (see render.h) already is a palette image, so with one-byte
+// indexes it goes to lodepng with automatic color conversion off: no pass over
+// the pixels to find their colors, and a quarter of the bytes of an RGBA image to
+// filter and deflate. The buffer's entries depend on the frames drawn into it
+// before, so the PNG gets the base colors and then the frame's job colors in job
+// order, and the indexes are mapped to that palette on the way out (unless they
+// already match), so the file is the same for any thread count or --frames range.
+// A PNG palette holds at most
+// 256 colors, so an image with two-byte indexes is turned into RGB first, one band
+// of rows at a time.
+//
+
+// write a frame buffer to a PNG file, on the pool if one is given; returns a lodepng error
+unsigned write_png(const std::string& _fn, const frame_buffer_t& _fb,
+                   const unsigned _width, const unsigned _height,
+                   const int _band_rows, thread_pool_t* const _pool) {
+
+  lodepng::State state;
+  state.encoder.auto_convert = 0;
+  std::vector<unsigned char> png;
+  unsigned error = 0;
+
+  if (_fb.pixel_size == 1) {
+    // each buffer entry's place in the written palette (an entry not in this frame shows on no pixel)
+    std::vector<uint32_t> palette(_fb.palette.begin(), _fb.palette.begin() + num_base_colors);
+    unsigned char remap[256] = {0};
+    bool same = true;
+    for (int e=0; e<num_base_colors; ++e) remap[e] = (unsigned char)e;
+    for (const uint32_t rgba : _fb.frame_colors) {
+      const int e = _fb.entry.find(rgba)->second;
+      remap[e] = (unsigned char)palette.size();
+      same = same and e == (int)palette.size();
+      palette.push_back(rgba);
+    }
+
+    for (LodePNGColorMode* mode : {&state.info_raw, &state.info_png.color}) {
+      mode->colortype = LCT_PALETTE;
+      mode->bitdepth = 8;
+      for (const uint32_t rgba : palette) {
+        unsigned char c[4];
+        std::memcpy(c, &rgba, 4);
+        lodepng_palette_add(mode, c[0], c[1], c[2], c[3]);
+      }
+    }
+
+    if (same) {
+      error = lodepng::encode(png, _fb.image.data(), _width, _height, state);
+    } else {
+      std::vector<unsigned char> image(_fb.image.size());
+      const int nbands = ((int)_height + _band_rows - 1) / _band_rows;
+      auto remap_band = [&](const int _b) {
+        const size_t first = (size_t)_b * _band_rows * _width;
+        const size_t last = std::min<size_t>(first + (size_t)_band_rows * _width, image.size());
+        for (size_t i=first; i<last; ++i) image[i] = remap[_fb.image[i]];
+      };
+      if (_pool) _pool->parallel_for(nbands, remap_band);
+      else for (int b=0; b<nbands; ++b) remap_band(b);
+      error = lodepng::encode(png, image, _width, _height, state);
+    }
+
+  } else {
+    std::vector<unsigned char> rgb(3 * (size_t)_width * _height);
+    const int nbands = ((int)_height + _band_rows - 1) / _band_rows;
+    auto convert_band = [&](const int _b) {
+      const size_t first = (size_t)_b * _band_rows * _width;
+      const size_t last = std::min<size_t>(first + (size_t)_band_rows * _width, (size_t)_width * _height);
+      for (size_t i=first; i<last; ++i) {
+        uint16_t idx;
+        std::memcpy(&idx, &_fb.image[2*i], 2);
+        std::memcpy(&rgb[3*i], &_fb.palette[idx], 3);
+      }
+    };
+    if (_pool) _pool->parallel_for(nbands, convert_band);
+    else for (int b=0; b<nbands; ++b) convert_band(b);
+
+    for (LodePNGColorMode* mode : {&state.info_raw, &state.info_png.color}) {
+      mode->colortype = LCT_RGB;
+      mode->bitdepth = 8;
+    }
+    error = lodepng::encode(png, rgb, _width, _height, state);
+  }
+
+  if (not error) error = lodepng::save_file(png, _fn);
+  return error;
+}
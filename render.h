@@ -0,0 +1,513 @@
+//
+// render.h
+//
+// Draw the nodes of jobs into an image of palette indexes, with kernels
+// specialized at compile time for the layouts of the built-in machines
+//
+// (c)2023 Mark J Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include "switchboard.h"
+#include "machine.h"
+#include "hostlist.h"
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <iostream>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+using simd_pixels_t = __m256i;
+inline __m256i splat_bytes(const uint8_t _v) { return _mm256_set1_epi8((char)_v); }
+inline __m256i splat_bytes(const uint16_t _v) { return _mm256_set1_epi16((short)_v); }
+inline __m256i splat_bytes(const uint32_t _v) { return _mm256_set1_epi32((int)_v); }
+inline void store_vector(unsigned char* _p, const __m256i _v) { _mm256_storeu_si256((__m256i*)_p, _v); }
+inline void stream_vector(unsigned char* _p, const __m256i _v) { _mm256_stream_si256((__m256i*)_p, _v); }
+#elif defined(__SSE2__)
+#include <immintrin.h>
+using simd_pixels_t = __m128i;
+inline __m128i splat_bytes(const uint8_t _v) { return _mm_set1_epi8((char)_v); }
+inline __m128i splat_bytes(const uint16_t _v) { return _mm_set1_epi16((short)_v); }
+inline __m128i splat_bytes(const uint32_t _v) { return _mm_set1_epi32((int)_v); }
+inline void store_vector(unsigned char* _p, const __m128i _v) { _mm_storeu_si128((__m128i*)_p, _v); }
+inline void stream_vector(unsigned char* _p, const __m128i _v) { _mm_stream_si128((__m128i*)_p, _v); }
+#endif
+
+//
+// Frames are drawn as palette indexes, one byte per pixel (two once a frame has
+// more colors than a byte can number). Which entry a color gets depends on the
+// frames drawn before, so each PNG is written with its entries put back in job
+// order (see png_output.h). Pixels of any size are filled a whole pixel (or a vector of
+// pixels) at a time, never a byte at a time.
+//
+
+// fill _n pixels of type P starting at _p with one value; a span of at least one
+// vector ends with a vector store that overlaps the one before, instead of a scalar tail
+template <class P>
+inline void fill_span(unsigned char* _p, size_t _n, const P _val) {
+#if defined(__AVX2__) || defined(__SSE2__)
+  constexpr size_t per_vector = sizeof(simd_pixels_t) / sizeof(P);
+  if (_n >= per_vector) {
+    const simd_pixels_t v = splat_bytes(_val);
+    unsigned char* const last = _p + sizeof(P)*(_n-per_vector);
+    for (; _p < last; _p += sizeof(simd_pixels_t)) store_vector(_p, v);
+    store_vector(last, v);
+    return;
+  }
+#endif
+  for (; _n > 0; --_n, _p += sizeof(P)) std::memcpy(_p, &_val, sizeof(P));
+}
+
+// fill a rectangle of pixels, one span per row
+template <class P>
+inline void fill_rect(unsigned char* const _image, const size_t _width,
+                      const int _x, const int _y, const int _w, const int _h, const P _val) {
+  for (int y=0; y<_h; ++y) fill_span(_image + sizeof(P)*((size_t)(_y+y)*_width + _x), _w, _val);
+}
+
+// fill a whole image with non-temporal stores, which go straight to memory instead
+// of first reading every line of the destination into the cache
+template <class P>
+inline void clear_image(unsigned char* _p, size_t _n, const P _val) {
+#if defined(__AVX2__) || defined(__SSE2__)
+  // pixels one at a time up to a vector boundary, if the pixels line up with one at all
+  if ((uintptr_t)_p % sizeof(P) == 0) {
+    for (; _n > 0 and (uintptr_t)_p % sizeof(simd_pixels_t) != 0; --_n, _p += sizeof(P)) std::memcpy(_p, &_val, sizeof(P));
+    constexpr size_t per_vector = sizeof(simd_pixels_t) / sizeof(P);
+    const simd_pixels_t v = splat_bytes(_val);
+    for (; _n >= per_vector; _n -= per_vector, _p += sizeof(simd_pixels_t)) stream_vector(_p, v);
+    // make the streamed stores visible before anything else reads them
+    _mm_sfence();
+  }
+#endif
+  fill_span(_p, _n, _val);
+}
+
+// one RGBA color as a whole 4-byte value
+inline uint32_t pack_rgba(const unsigned char* const _color) {
+  uint32_t rgba;
+  std::memcpy(&rgba, _color, 4);
+  return rgba;
+}
+
+// the colors of the base image, which are also the first entries of every palette
+enum base_index_t : uint8_t { background_index = 0, border_index = 1, unused_index = 2, num_base_colors = 3 };
+const unsigned char base_colors[num_base_colors][4] = {
+  {255, 255, 255, 255},		// background
+  {192, 192, 192, 255},		// borders
+  {231, 231, 231, 255} };	// nodes without a job (not drawn for now)
+
+//
+// The machine's node tables (see machine.h) already say where each node's box
+// goes and how many boxes follow it in the same row, so drawing a range is just
+// table loads and fills. What's left is the box pitch and the size of the filled
+// part of each box: for a fixed layout these are compile-time constants, so each
+// row of a box is filled with a few wide stores.
+//
+
+// set from a machine at runtime, for any machine description
+struct runtime_layout_t {
+  static constexpr int fixed_xwid = 0;	// not known until runtime
+  int pitch;
+  int xwid;
+  int yhgt;
+};
+
+// the same, as template parameters
+template <int PITCH, int XWID, int YHGT>
+struct fixed_layout_t {
+  static constexpr int fixed_xwid = XWID;
+  static constexpr int pitch = PITCH;
+  static constexpr int xwid = XWID;
+  static constexpr int yhgt = YHGT;
+
+  static bool matches(const runtime_layout_t& _l) {
+    return _l.pitch == pitch and _l.xwid == xwid and _l.yhgt == yhgt;
+  }
+};
+
+// 5x5 node boxes with a 1-pixel border, drawn over, on a 9-pixel pitch: the layout
+// of both built-in machines (see builtin_machines)
+using box5_layout_t = fixed_layout_t<9, 7, 7>;
+
+// fill the boxes of all nodes in _nodes with the pixel value _val, one run of
+// horizontally adjacent nodes (one row of one group) at a time, with a node table's
+// offsets and run lengths; given the top row of each box, only the rows in [_y0,_y1)
+// are drawn
+template <class L, class P>
+void draw_node_ranges(const L& _lay, const int* const _offset, const int* const _run,
+                      const node_set_t& _nodes,
+                      unsigned char* const _image, const int _width, const P _val,
+                      const int* const _top = nullptr, const int _y0 = 0, const int _y1 = 0) {
+
+  // with a fixed width, one whole row of a box, copied with a few wide stores
+  P boxrow[std::max(1, L::fixed_xwid)];
+  std::fill(boxrow, boxrow + std::max(1, L::fixed_xwid), _val);
+
+  // local copies, since stores into the image could alias anything in memory
+  const int pitch = _lay.pitch;
+  const int xwid = _lay.xwid;
+  const int yhgt = _lay.yhgt;
+  const size_t rowbytes = sizeof(P)*(size_t)_width;
+
+  for (const auto& range : _nodes) {
+    for (int nodeidx = range.first; nodeidx <= range.last; ) {
+
+      // this run ends at the end of the range, the row, or the group
+      const int nrun = std::min(range.last - nodeidx + 1, _run[nodeidx]);
+
+      // draw the blocks of color, one pixel row across the whole run at a time
+      unsigned char* py = _image + sizeof(P)*(size_t)_offset[nodeidx];
+      int y = 0;
+      int yend = yhgt;
+      if (_top) {
+        y = std::max(0, _y0 - _top[nodeidx]);
+        yend = std::min(yhgt, _y1 - _top[nodeidx]);
+        py += (size_t)y*rowbytes;
+      }
+      for (; y<yend; ++y, py += rowbytes) {
+        for (int n=0; n<nrun; ++n) {
+          unsigned char* px = py + sizeof(P)*n*pitch;
+          if constexpr (L::fixed_xwid > 0) std::memcpy(px, boxrow, sizeof(boxrow));
+          else fill_span(px, xwid, _val);
+        }
+      }
+
+      nodeidx += nrun;
+    }
+  }
+}
+
+// An image of palette indexes that is drawn into frame after frame, along with
+// the color that each node has in it, so that the next frame only needs to
+// repaint the nodes whose color changes (see job_renderer_t). Each job color gets
+// a palette entry for as long as it is in frames, and an entry is given to a new
+// color once its old one is gone; a node that changes color is always repainted,
+// so no node is ever left showing an entry that now means another color.
+struct frame_buffer_t {
+  static constexpr uint32_t unused = 0;	// a node showing the base image (no color is transparent)
+  static constexpr size_t max_palette = 65536;
+
+  int pixel_size = 1;			// 1, or 2 while the palette needs more than 256 entries
+  std::vector<unsigned char> image;
+  std::vector<uint32_t> palette;	// the RGBA color of each index
+  std::vector<uint32_t> node_color;	// as drawn in the image
+  std::vector<uint32_t> next_color;	// as wanted in the next frame
+
+  // the entry of each job color, the last frame that used each entry, and the
+  // colors with no entry yet
+  std::unordered_map<uint32_t,int> entry;
+  std::vector<int> entry_frame;
+  std::vector<uint32_t> new_colors;
+  std::vector<uint32_t> frame_colors;	// every job color of this frame, in job order
+  int frame = 0;
+};
+
+// choose a kernel for a machine once, then draw any number of jobs with it
+struct job_renderer_t {
+
+  job_renderer_t(const machine_t& _mach, const bool _overwrite_border) {
+    // the size of each box to draw, and where
+    const int m = _overwrite_border ? 1 : 0;
+    lay.pitch = _mach.boxwid[0];
+    lay.xwid = _mach.node_xwid[m];
+    lay.yhgt = _mach.node_yhgt[m];
+    offset = _mach.node_offset[m].data();
+    run = _mach.node_run.data();
+    nnodes = (int)_mach.node_run.size();
+    width = _mach.width;
+    height = _mach.height;
+
+    // a specialized kernel for any machine laid out like a built-in one (like a
+    // description of the same machine by xname), since only the sizes matter
+    if (box5_layout_t::matches(lay)) kernel = kernel_t::box5;
+    const char* const kernel_name[] = {"generic", "5x5 box"};
+    std::cout << "Using the " << kernel_name[(int)kernel] << " drawing kernel" << std::endl;
+  }
+
+  // split the image into bands of _rows rows each, so that one frame can be drawn
+  // on several threads, and note which nodes have boxes in each band
+  void set_bands(const int _rows) {
+    band_rows = _rows;
+    band_nodes.assign((height + _rows - 1) / _rows, node_set_t());
+    top.resize(nnodes);
+    for (int k=0; k<nnodes; ++k) {
+      top[k] = offset[k] / width;
+      const int last = std::min((top[k] + lay.yhgt - 1) / _rows, (int)band_nodes.size() - 1);
+      for (int b = top[k] / _rows; b <= last; ++b) {
+        node_set_t& nodes = band_nodes[b];
+        if (not nodes.empty() and nodes.back().last == k-1) nodes.back().last = k;
+        else nodes.push_back(node_range_t{k, k});
+      }
+    }
+  }
+
+  int num_bands() const { return (int)band_nodes.size(); }
+
+  // the first and last+1 rows of a band
+  int band_first_row(const int _band) const { return _band * band_rows; }
+  int band_end_row(const int _band) const { return std::min(height, (_band+1) * band_rows); }
+
+  // Drawing a frame into a frame buffer takes four steps: start_frame, then
+  // add_job for every job (in order, later ones cover earlier ones), then
+  // set_palette, then repaint, all at once or one band at a time (with -1 or a
+  // band), then end_frame
+
+  void start_frame(frame_buffer_t& _fb, const std::vector<unsigned char>& _base_image) const {
+    if (_fb.image.empty()) {
+      _fb.pixel_size = 1;
+      _fb.image = _base_image;
+      _fb.palette.clear();
+      for (const auto& color : base_colors) _fb.palette.push_back(pack_rgba(color));
+      _fb.entry_frame.assign(_fb.palette.size(), 0);
+      _fb.entry.clear();
+      _fb.node_color.assign(nnodes, frame_buffer_t::unused);
+    }
+    ++_fb.frame;
+    _fb.next_color.assign(nnodes, frame_buffer_t::unused);
+    _fb.frame_colors.clear();
+  }
+
+  void add_job(frame_buffer_t& _fb, const job_t& _job, const unsigned char* const _color) const {
+    const uint32_t rgba = pack_rgba(_color);
+    const auto found = _fb.entry.find(rgba);
+    if (found == _fb.entry.end()) {
+      _fb.entry.emplace(rgba, -1);
+      _fb.new_colors.push_back(rgba);
+      _fb.frame_colors.push_back(rgba);
+    } else if (found->second >= 0 and _fb.entry_frame[found->second] != _fb.frame) {
+      _fb.entry_frame[found->second] = _fb.frame;
+      _fb.frame_colors.push_back(rgba);
+    }
+    for (const auto& range : _job.nodes()) {
+      std::fill(_fb.next_color.begin() + range.first, _fb.next_color.begin() + range.last + 1, rgba);
+    }
+  }
+
+  // give each color new in this frame the palette entry of a color that isn't in
+  // it, or a new entry, and widen the image once there are too many for a byte;
+  // with two-byte indexes, first see if this frame's colors fit in a byte again
+  void set_palette(frame_buffer_t& _fb) const {
+    if (_fb.pixel_size == 2) {
+      size_t ncolors = num_base_colors + _fb.new_colors.size();
+      for (int e=num_base_colors; e<(int)_fb.palette.size(); ++e) ncolors += (_fb.entry_frame[e] == _fb.frame);
+      if (ncolors <= 256) {
+        std::cout << "At most 256 colors again, using 1-byte palette indexes" << std::endl;
+        compact_palette(_fb);
+      }
+    }
+
+    int e = num_base_colors;
+    for (const uint32_t rgba : _fb.new_colors) {
+      while (e < (int)_fb.palette.size() and _fb.entry_frame[e] == _fb.frame) ++e;
+      if (e == (int)_fb.palette.size()) {
+        _fb.palette.push_back(rgba);
+        _fb.entry_frame.push_back(0);
+      } else {
+        const auto old = _fb.entry.find(_fb.palette[e]);
+        if (old != _fb.entry.end() and old->second == e) _fb.entry.erase(old);
+        _fb.palette[e] = rgba;
+      }
+      _fb.entry[rgba] = e;
+      _fb.entry_frame[e] = _fb.frame;
+    }
+    _fb.new_colors.clear();
+    assert (_fb.palette.size() <= frame_buffer_t::max_palette && "Too many job colors in one frame");
+
+    if (_fb.pixel_size == 1 and _fb.palette.size() > 256) {
+      std::cout << "More than 256 colors, using 2-byte palette indexes" << std::endl;
+      std::vector<unsigned char> wide(2*_fb.image.size());
+      for (size_t i=0; i<_fb.image.size(); ++i) {
+        const uint16_t idx = _fb.image[i];
+        std::memcpy(&wide[2*i], &idx, 2);
+      }
+      _fb.image.swap(wide);
+      _fb.pixel_size = 2;
+    }
+  }
+
+  // paint every node (in the band) whose color changed, in runs of neighboring nodes
+  // with the same new color, and put back the base image where a node is now unused
+  void repaint(frame_buffer_t& _fb, const std::vector<unsigned char>& _base_image, const int _band) const {
+    const int* const clip_top = (_band < 0) ? nullptr : top.data();
+    const int y0 = (_band < 0) ? 0 : band_first_row(_band);
+    const int y1 = (_band < 0) ? height : band_end_row(_band);
+    const uint32_t* const have = _fb.node_color.data();
+    const uint32_t* const want = _fb.next_color.data();
+    node_set_t run_nodes(1);
+
+    auto repaint_range = [&](const int _first, const int _last) {
+      for (int k = _first; k <= _last; ) {
+        if (want[k] == have[k]) {
+          ++k;
+          continue;
+        }
+        int n = k + 1;
+        while (n <= _last and want[n] == want[k] and want[n] != have[n]) ++n;
+
+        if (want[k] != frame_buffer_t::unused) {
+          run_nodes[0] = node_range_t{k, n-1};
+          draw_nodes(run_nodes, _fb.image.data(), _fb.pixel_size, _fb.entry.find(want[k])->second, clip_top, y0, y1);
+        } else {
+          for (int j = k; j < n; ++j) {
+            const int top_row = offset[j] / width;
+            for (int y = std::max(top_row, y0); y < std::min(top_row + lay.yhgt, y1); ++y) {
+              const size_t px = (size_t)offset[j] + (size_t)(y - top_row)*width;
+              if (_fb.pixel_size == 1) {
+                std::memcpy(&_fb.image[px], &_base_image[px], lay.xwid);
+              } else {
+                for (int i=0; i<lay.xwid; ++i) {
+                  const uint16_t idx = _base_image[px+i];
+                  std::memcpy(&_fb.image[2*(px+i)], &idx, 2);
+                }
+              }
+            }
+          }
+        }
+        k = n;
+      }
+    };
+
+    if (_band < 0) repaint_range(0, nnodes-1);
+    else for (const auto& range : band_nodes[_band]) repaint_range(range.first, range.last);
+  }
+
+  void end_frame(frame_buffer_t& _fb) const {
+    _fb.node_color.swap(_fb.next_color);
+  }
+
+private:
+  enum class kernel_t { generic, box5 };
+
+  // number the entries of this frame's colors right after the base colors, drop
+  // every other entry, and go back to one-byte indexes; a pixel of a color that
+  // is gone becomes the background for now, since its node is repainted anyway
+  void compact_palette(frame_buffer_t& _fb) const {
+    std::vector<int> remap(_fb.palette.size(), background_index);
+    std::vector<uint32_t> palette;
+    for (int e=0; e<(int)_fb.palette.size(); ++e) {
+      if (e >= num_base_colors and _fb.entry_frame[e] != _fb.frame) continue;
+      remap[e] = (int)palette.size();
+      palette.push_back(_fb.palette[e]);
+    }
+
+    std::vector<unsigned char> narrow(_fb.image.size() / 2);
+    for (size_t i=0; i<narrow.size(); ++i) {
+      uint16_t idx;
+      std::memcpy(&idx, &_fb.image[2*i], 2);
+      narrow[i] = (unsigned char)remap[idx];
+    }
+    _fb.image.swap(narrow);
+    _fb.pixel_size = 1;
+    _fb.palette.swap(palette);
+    _fb.entry_frame.assign(_fb.palette.size(), _fb.frame);
+    _fb.entry.clear();
+    for (int e=num_base_colors; e<(int)_fb.palette.size(); ++e) _fb.entry[_fb.palette[e]] = e;
+    for (const uint32_t rgba : _fb.new_colors) _fb.entry[rgba] = -1;
+  }
+
+  void draw_nodes(const node_set_t& _nodes, unsigned char* const _image, const int _pixel_size, const int _index,
+                  const int* const _top, const int _y0, const int _y1) const {
+    if (_pixel_size == 1) draw_nodes_as(_nodes, _image, (uint8_t)_index, _top, _y0, _y1);
+    else draw_nodes_as(_nodes, _image, (uint16_t)_index, _top, _y0, _y1);
+  }
+
+  template <class P>
+  void draw_nodes_as(const node_set_t& _nodes, unsigned char* const _image, const P _val,
+                     const int* const _top, const int _y0, const int _y1) const {
+    switch (kernel) {
+    case kernel_t::box5:
+      draw_node_ranges(box5_layout_t(), offset, run, _nodes, _image, width, _val, _top, _y0, _y1);
+      break;
+    default:
+      draw_node_ranges(lay, offset, run, _nodes, _image, width, _val, _top, _y0, _y1);
+    }
+  }
+
+  runtime_layout_t lay;
+  const int* offset;
+  const int* run;
+  int nnodes;
+  int width;				// of the whole image
+  int height;
+  kernel_t kernel = kernel_t::generic;
+
+  int band_rows = 0;
+  std::vector<node_set_t> band_nodes;	// the nodes with boxes in each band
+  std::vector<int> top;			// the top row of each node's box
+};
+
+// the image that every frame of a machine starts from: white, with the borders of
+// the outlined levels drawn in, as one-byte indexes into base_colors
+std::vector<unsigned char> draw_base_image(const machine_t& _mach) {
+  const std::vector<int>& total_num = _mach.total_num;
+  const std::vector<int>& boxszx = _mach.boxszx;
+  const std::vector<int>& boxszy = _mach.boxszy;
+  const std::vector<int>& boxbdr = _mach.boxbdr;
+
+  // allocate and initialize the base image
+  const unsigned int out_width = _mach.width;
+  const unsigned int out_height = _mach.height;
+  printf("Will create %d x %d image\n", out_width, out_height);
+  std::vector<unsigned char> base_image;
+  base_image.resize(out_width * out_height);
+  unsigned char* const image = base_image.data();
+
+  // fill with solid white
+  clear_image(image, (size_t)out_width*out_height, (uint8_t)background_index);
+
+  // march through all levels and draw their boxes
+
+  const uint8_t bdrindex = border_index;
+
+  for (int i=0; i<_mach.nlevels; ++i) {
+    if (not _mach.outline[i]) continue;
+    std::cout << "Drawing outlines for " << total_num[i] << " blocks at level " << i << std::endl;
+
+    if (boxbdr[i] > 0) {
+
+    // can add openmp here if necessary
+    for (int cnt = 0; cnt < total_num[i]; cnt++) {
+
+      // top left corner
+      const int x = _mach.box_x[i][cnt];
+      const int y = _mach.box_y[i][cnt];
+      const int bdr = boxbdr[i];
+
+      // draw the top and bottom bars
+      fill_rect(image, out_width, x, y, boxszx[i]+2*bdr, bdr, bdrindex);
+      fill_rect(image, out_width, x, y+bdr+boxszy[i], boxszx[i]+2*bdr, bdr, bdrindex);
+
+      // draw the sides
+      fill_rect(image, out_width, x, y+bdr, bdr, boxszy[i], bdrindex);
+      fill_rect(image, out_width, x+bdr+boxszx[i], y+bdr, bdr, boxszy[i], bdrindex);
+    }
+    }
+  }
+
+  // draw a default color for every node
+  if (false) {
+    // get a color for this job
+    const uint8_t unusedindex = unused_index;
+
+    // now march through all participating nodes and color their boxes
+    for (int nodeidx = 0; nodeidx < total_num[0]; nodeidx++) {
+
+      // and the size of the box to draw
+      const int xwid = boxszx[0] + 2*boxbdr[0];
+      const int yhgt = boxszy[0] + 2*boxbdr[0];
+
+      // draw the block of color
+      fill_rect(image, out_width, _mach.box_x[0][nodeidx], _mach.box_y[0][nodeidx], xwid, yhgt, unusedindex);
+    }
+  }
+
+  return base_image;
+}
@@ -12,7 +12,11 @@
 #include <array>
 #include <map>
 #include <random>
+#include <string>
+#include <sstream>
 #include <iostream>
+#include <cstdint>
+#include <cmath>
 
 // colors stored as float32 internally
 // but retrieved as a variety of types (unsigned char, for 8-bit applications)
@@ -22,6 +26,32 @@
 // map between unique jobid (key) and xyz in unit cube (value)
 std::map<int,std::array<float,4>> job_to_xyz;
 
+// the random number engine used to pick new colors
+std::mt19937 color_rng;
+bool color_rng_started = false;
+
+// everything that decides which color the next new job gets; the engine's whole
+// state is kept (as the text that operator<< writes), so restoring it takes the
+// same time however many numbers were drawn before
+struct color_state_t {
+  std::map<int,std::array<float,4>> palette;
+  std::string rng_state;
+  bool rng_started;
+};
+
+std::string get_rng_state() {
+  std::ostringstream out;
+  out << color_rng;
+  return out.str();
+}
+
+void set_color_state(const color_state_t& _state) {
+  job_to_xyz = _state.palette;
+  std::istringstream in(_state.rng_state);
+  in >> color_rng;
+  color_rng_started = _state.rng_started;
+}
+
 // empty out the vector
 void reset_color_palette() {
   job_to_xyz.clear();
@@ -100,13 +130,11 @@ void get_next_color(const int _id, unsigned char* _c) {
   //std::cout << "    not found\n";
 
   // get the random generator started
-  std::random_device rdev;    // Will be used to obtain a seed for the random number engine
-  static std::mt19937 rgen(rdev());   // Standard mersenne_twister_engine seeded with rd()
-  static bool initialized = false;
+  std::mt19937& rgen = color_rng;
 
-  if (not initialized) {
+  if (not color_rng_started) {
     rgen.seed(12345);
-    initialized = true;
+    color_rng_started = true;
 
     // ensure that we're empty
     reset_color_palette();
@@ -0,0 +1,281 @@
+//
+// sacct_timeline.h
+//
+// Build frames at fixed time steps from sacct job accounting records
+//
+// (c)2023 Mark J Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include "switchboard.h"
+#include "machine.h"
+#include "hostlist.h"
+
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <iostream>
+
+//
+// Input is the output of something like
+//   sacct -a -X --parsable2 -S 2023-05-01 -E 2023-06-01 -o JobID,Start,End,NodeList
+// a header line naming the columns (in any order, others are ignored), then one
+// job per line, fields separated by '|'. Job steps (ids with a '.') are skipped,
+// array tasks ("1234_7") use the array's id, and jobs that never started are dropped.
+// An End of "Unknown" means the job is still running.
+//
+// Frame k covers the times [t0 + k*step, t0 + (k+1)*step) and holds every job that
+// ran at any moment in that span, so that jobs shorter than a step still show up.
+//
+
+// seconds since 1970-01-01 for a civil date and time (no time zones, no leap seconds)
+int64_t seconds_from_civil(int _y, const int _m, const int _d, const int _hh, const int _mm, const int _ss) {
+  // days_from_civil, from Howard Hinnant's date algorithms
+  _y -= (_m <= 2);
+  const int64_t era = (_y >= 0 ? _y : _y-399) / 400;
+  const int64_t yoe = _y - era * 400;
+  const int64_t doy = (153*(_m > 2 ? _m-3 : _m+9) + 2)/5 + _d-1;
+  const int64_t doe = yoe * 365 + yoe/4 - yoe/100 + doy;
+  const int64_t days = era * 146097 + doe - 719468;
+  return days*86400 + _hh*3600 + _mm*60 + _ss;
+}
+
+// and back again, as YYYYMMDDTHHMMSS
+std::string civil_from_seconds(const int64_t _t) {
+  int64_t days = _t / 86400;
+  int64_t secs = _t % 86400;
+  if (secs < 0) { secs += 86400; --days; }
+  days += 719468;
+  const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+  const int64_t doe = days - era * 146097;
+  const int64_t yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+  const int64_t doy = doe - (365*yoe + yoe/4 - yoe/100);
+  const int64_t mp = (5*doy + 2)/153;
+  const int d = doy - (153*mp+2)/5 + 1;
+  const int m = mp < 10 ? mp+3 : mp-9;
+  const int y = yoe + era * 400 + (m <= 2);
+
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%04d%02d%02dT%02d%02d%02d", y, m, d,
+                (int)(secs/3600), (int)(secs/60%60), (int)(secs%60));
+  return std::string(buf);
+}
+
+// parse a time like 2023-05-01T12:34:56, return false if it isn't one
+bool parse_sacct_time(const char* _p, const char* const _end, int64_t& _t) {
+  int v[6] = {0, 0, 0, 0, 0, 0};
+  const char seps[6] = {'-', '-', 'T', ':', ':', '\0'};
+  for (int i=0; i<6; ++i) {
+    if (_p == _end or not is_digit(*_p)) return false;
+    while (_p != _end and is_digit(*_p)) v[i] = v[i]*10 + (*_p++ - '0');
+    if (i < 5) {
+      if (_p == _end or *_p != seps[i]) return false;
+      ++_p;
+    }
+  }
+  _t = seconds_from_civil(v[0], v[1], v[2], v[3], v[4], v[5]);
+  return true;
+}
+
+// parse a time step like 300, 30s, 5m, 2h or 1d, into seconds
+int64_t parse_time_step(const std::string& _step) {
+  size_t used = 0;
+  const int64_t n = std::stoll(_step, &used);
+  const std::string unit = _step.substr(used);
+  if (unit.empty() or unit == "s") return n;
+  if (unit == "m") return n*60;
+  if (unit == "h") return n*3600;
+  if (unit == "d") return n*86400;
+  throw std::invalid_argument("unknown time unit in " + _step);
+}
+
+struct sacct_timeline_t {
+
+  sacct_timeline_t(const std::vector<machine_t>& _machines) : machines(_machines) {}
+
+  // consume the next piece of the input, which is split into lines here
+  void feed(const char* _p, const char* const _end) {
+    while (_p != _end) {
+      const char* eol = (const char*)std::memchr(_p, '\n', _end - _p);
+      if (not eol) {
+        partial.append(_p, _end);
+        return;
+      }
+      if (partial.empty()) {
+        add_line(_p, eol);
+      } else {
+        partial.append(_p, eol);
+        add_line(partial.data(), partial.data() + partial.size());
+        partial.clear();
+      }
+      _p = eol + 1;
+    }
+  }
+
+  // sweep over the sorted start and end times, handing over one frame per step,
+  // each one named _stem_YYYYMMDDTHHMMSS.png
+  void finish(const int64_t _step, const std::string& _stem, std::function<void(frame_t&&)> _on_frame) {
+    if (not partial.empty()) add_line(partial.data(), partial.data() + partial.size());
+    partial.clear();
+    std::cout << "Read " << jobs.size() << " job records (" << nskipped << " skipped)" << std::endl;
+    if (jobs.empty() or _step <= 0) return;
+
+    // both lists of events, as job indexes sorted by time
+    std::vector<int> starts(jobs.size());
+    for (size_t i=0; i<jobs.size(); ++i) starts[i] = i;
+    std::vector<int> ends = starts;
+    std::stable_sort(starts.begin(), starts.end(), [&](int a, int b) { return jobs[a].start < jobs[b].start; });
+    std::stable_sort(ends.begin(), ends.end(), [&](int a, int b) { return jobs[a].end < jobs[b].end; });
+
+    // the first step holds the first start, the last one the last known time
+    int64_t tlast = jobs[starts.back()].start;
+    for (const auto& job : jobs) if (job.end != still_running) tlast = std::max(tlast, job.end);
+    const int64_t t0 = floor_div(jobs[starts.front()].start, _step) * _step;
+    std::cout << "Building " << (tlast - t0) / _step + 1 << " frames at " << _step << " second steps" << std::endl;
+
+    // the jobs active in the current step, in start order
+    std::map<std::pair<int64_t,int>, int> active;
+    size_t nextstart = 0;
+    size_t nextend = 0;
+
+    for (int64_t t = t0; t <= tlast; t += _step) {
+      // every job that started before the end of this step is in it
+      for (; nextstart < starts.size() and jobs[starts[nextstart]].start < t + _step; ++nextstart) {
+        const int i = starts[nextstart];
+        active.emplace(std::make_pair(jobs[i].start, i), i);
+      }
+
+      frame_t frame;
+      frame.name = _stem + "_" + civil_from_seconds(t) + ".png";
+      frame.jobs.reserve(active.size());
+      for (const auto& entry : active) frame.jobs.push_back(jobs[entry.second].job);
+      std::cout << "Finishing frame " << frame.name << " with " << frame.jobs.size() << " jobs" << std::endl;
+      _on_frame(std::move(frame));
+
+      // and a job that ended by the end of this step is not in the next one
+      for (; nextend < ends.size() and jobs[ends[nextend]].end <= t + _step; ++nextend) {
+        const int i = ends[nextend];
+        active.erase(std::make_pair(jobs[i].start, i));
+      }
+    }
+  }
+
+private:
+  static constexpr int64_t still_running = std::numeric_limits<int64_t>::max();
+
+  struct record_t {
+    int64_t start;
+    int64_t end;
+    job_t job;
+  };
+
+  static int64_t floor_div(const int64_t _a, const int64_t _b) {
+    return _a / _b - (_a % _b < 0);
+  }
+
+  void add_line(const char* _p, const char* const _end) {
+    // split on the delimiter
+    fields.clear();
+    for (const char* f = _p; ; ) {
+      const char* bar = (const char*)std::memchr(f, '|', _end - f);
+      fields.emplace_back(f, bar ? bar : _end);
+      if (not bar) break;
+      f = bar + 1;
+    }
+
+    // the first line names the columns
+    if (col_jobid < 0) {
+      for (int i=0; i<(int)fields.size(); ++i) {
+        std::string name(fields[i].first, fields[i].second);
+        for (auto& c : name) if (c >= 'A' and c <= 'Z') c += 'a' - 'A';
+        if (name == "jobid") col_jobid = i;
+        else if (name == "start") col_start = i;
+        else if (name == "end") col_end = i;
+        else if (name == "nodelist") col_nodes = i;
+      }
+      if (col_jobid < 0 or col_start < 0 or col_end < 0 or col_nodes < 0) {
+        std::cout << "sacct header needs JobID, Start, End and NodeList columns" << std::endl;
+        col_jobid = std::numeric_limits<int>::max();
+      }
+      return;
+    }
+    const int ncols = std::max(std::max(col_jobid, col_start), std::max(col_end, col_nodes)) + 1;
+    if ((int)fields.size() < ncols) {
+      if (_p != _end) ++nskipped;
+      return;
+    }
+
+    record_t rec;
+
+    // the jobid, skipping job steps
+    rec.job.jobid = 0;
+    const char* q = fields[col_jobid].first;
+    while (q != fields[col_jobid].second and is_digit(*q)) rec.job.jobid = rec.job.jobid*10 + (*q++ - '0');
+    if (q == fields[col_jobid].first or std::find(q, fields[col_jobid].second, '.') != fields[col_jobid].second) {
+      ++nskipped;
+      return;
+    }
+
+    if (not parse_sacct_time(fields[col_start].first, fields[col_start].second, rec.start)) {
+      ++nskipped;
+      return;
+    }
+    if (not parse_sacct_time(fields[col_end].first, fields[col_end].second, rec.end)) rec.end = still_running;
+    // a job lasts at least a second, so it always ends after the step it starts in
+    rec.end = std::max(rec.end, rec.start + 1);
+
+    // every hostlist in the node list, one job for each machine it uses
+    bool any = false;
+    for (int k=0; k<(int)machines.size(); ++k) {
+      const std::string& keyword = machines[k].keyword;
+      const bool xname = machines[k].map.xname;
+      node_set_t nodes;
+      const char* n = fields[col_nodes].first;
+      const char* const nend = fields[col_nodes].second;
+      while (true) {
+        const char* m = std::search(n, nend, keyword.begin(), keyword.end());
+        if (m == nend) break;
+        n = m + keyword.size();
+        const char* hend;
+        if (xname) {
+          // an "x" only starts xnames at the beginning of a word, and only whole ones
+          hend = find_xname_end(n, nend);
+          const bool at_word_start = (m == fields[col_nodes].first or is_space(m[-1]) or m[-1] == ',');
+          if (not at_word_start or not is_xname(n, hend)) continue;
+        } else {
+          hend = find_hostlist_end(n != nend and *n == '[' ? n+1 : n, nend);
+          if (hend != nend and *hend == ']') ++hend;
+        }
+        decode_nodes(n, hend, machines[k].map, nodes);
+        n = hend;
+      }
+      if (nodes.empty()) continue;
+
+      rec.job.machine = k;
+      rec.job.hostlist = std::make_shared<const hostlist_t>(std::move(nodes));
+      jobs.push_back(rec);
+      any = true;
+    }
+    if (not any) ++nskipped;
+  }
+
+  const std::vector<machine_t>& machines;
+
+  int col_jobid = -1;
+  int col_start = -1;
+  int col_end = -1;
+  int col_nodes = -1;
+
+  std::string partial;			// a line split between two pieces of input
+  std::vector<std::pair<const char*, const char*>> fields;
+  std::vector<record_t> jobs;
+  int nskipped = 0;
+};
@@ -8,6 +8,16 @@
 //
 
 #include "switchboard.h"
+#include "machine.h"
+#include "nodelist_parser.h"
+#include "input_file.h"
+#include "parallel_parse.h"
+#include "thread_pool.h"
+#include "frame_cache.h"
+#include "frame_index.h"
+#include "sacct_timeline.h"
+#include "render.h"
+#include "png_output.h"
 #include "ryb_autocolor.h"
 
 #include "lodepng.h"
@@ -16,55 +26,16 @@
 #include <vector>
 #include <array>
 #include <string>
-#include <fstream>
 #include <iostream>
 #include <cstdio>
+#include <cstring>
 #include <cassert>
-#include <iterator>
+#include <algorithm>
+#include <thread>
+#include <memory>
+#include <limits>
 
 
-//
-// data for frontier, exascale machine at ORNL
-//
-// machine-specific
-const std::string machname = "frontier";		// name to look for in nodelist
-const int nlevels = 3;							// number of levels of hierarchy
-const int num_per_level[nlevels] = {128, 74, 1};// number of items in each level of hierarchy
-const int total_num[nlevels] = {9472, 74, 1};	// total number of items in each level
-int map_node_name(const int _n) {				// function to map the name of the machine to a 0-indexed, continuous index
-  if (_n <= 9088) return _n-1;
-  else if (_n >= 10113 and _n <= 10496) return _n-1025;
-  else return -1;
-}
-// drawing-specific
-const int base_size[2] = {5, 5};				// size of interior of finest block in pixels
-const int num_per_row[nlevels] = {8, 15, 1};	// number of items to draw in one row in each level
-const int block_border[nlevels] = {1, 1, 1};	// width of drawn border in each level in pixels
-const int block_gap[nlevels] = {2, 8, 16};		// width of white-space gap between each item at each level in pixels
-
-/*
-// data for crusher
-const std::string machname = "crusher";
-const int nlevels = 3;
-const int num_per_level[nlevels] = {128, 2, 1};
-const int total_num[nlevels] = {192, 2, 1};
-// map the name of the machine to a 0-indexed, continuous index
-int map_node_name(const int _n) {
-  if (_n <= 192) return _n-1;
-  else return -1;
-}
-const int base_size[2] = {5, 5};				// size of interior of finest block in pixels
-const int num_per_row[nlevels] = {8, 2, 1};
-const int block_border[nlevels] = {1, 1, 1};	// width of drawn border in each level in pixels
-const int block_gap[nlevels] = {2, 8, 16};		// width of white-space gap between each item at each level in pixels
-*/
-
-
-// how many rows are needed?
-int rows_needed(const int _n, const int _nperrow) {
-  return (_n+_nperrow-1)/_nperrow;
-}
-
 //
 // entry and exit
 //
@@ -75,9 +46,31 @@ int main(int argc, char *argv[]) {
   // set up command line arg definitions
   CLI::App app{"Generate hierarchical block rendering of jobs on a supercomputer"};
   std::string nodefn = "nodelist";
-  app.add_option("-n,--nodelist", nodefn, "name of nodelist text file");
+  app.add_option("-n,--nodelist", nodefn, "name of nodelist text file, or - for stdin");
   std::string pngfn = "out.png";
   app.add_option("-o,--output", pngfn, "name of output png file");
+  std::vector<std::string> machfns = {"frontier"};
+  app.add_option("-m,--machine", machfns, "built-in machine (frontier or crusher) or machine description file, or several separated by commas")->delimiter(',');
+  int nthreads = std::max(1u, std::thread::hardware_concurrency());
+  app.add_option("-j,--threads", nthreads, "number of threads to use");
+  bool follow = false;
+  app.add_flag("-f,--follow", follow, "keep running, and draw new frames as they are appended to the nodelist");
+  std::string cachefn;
+  app.add_option("--write-cache", cachefn, "also save the parsed frames to this binary cache file, which can be given as a nodelist later");
+  std::string frames = "0..";
+  app.add_option("--frames", frames, "only draw these frames, counting from 0, like 12 or 12..40 or 12..");
+  int every = 1;
+  app.add_option("--every", every, "only draw every this many frames of that range, for a timelapse")->check(CLI::PositiveNumber);
+  std::string indexfn;
+  app.add_option("--index", indexfn, "frame index of the nodelist, for jumping straight to the first wanted frame");
+  std::string writeindexfn;
+  app.add_option("--write-index", writeindexfn, "also save a frame index of the nodelist to this file");
+  int index_stride = 16;
+  app.add_option("--index-stride", index_stride, "save the color palette in the index every this many frames");
+  bool sacct = false;
+  app.add_flag("--sacct", sacct, "the nodelist is sacct --parsable2 output with JobID, Start, End and NodeList columns");
+  std::string step = "5m";
+  app.add_option("--step", step, "with --sacct, time between frames, like 90s, 5m, 1h or 1d");
 
   // finally parse
   try {
@@ -86,394 +79,309 @@ int main(int argc, char *argv[]) {
     return app.exit(e);
   }
 
-  // node list can come from a copy-paste, or the output from "squeue -t running"
-  // ideally can we do "squeue -t running | switchboard frontier > image.png"
-
-  // --------------------------------------------------------------------------
-  // create arrays for the geometric hierarchy
-
-  int boxszx[nlevels];
-  int boxszy[nlevels];
-  int boxbdr[nlevels];
-  int boxgap[nlevels];
-  int boxwid[nlevels];
-  int boxhgt[nlevels];
-
-  // set drawing sizes per node/block/image
-  for (int i=0; i<nlevels; ++i) {
+  // the range of frames to draw, K or K..M or K..
+  int first_frame = 0;
+  int last_frame = std::numeric_limits<int>::max();
+  auto parse_frame_number = [](const std::string& _str, int& _k) {
+    size_t used = 0;
+    try {
+      _k = std::stoi(_str, &used);
+    } catch (const std::exception&) {
+      return false;
+    }
+    return used == _str.size() and _k >= 0;
+  };
+  const size_t dots = frames.find("..");
+  bool frames_ok = parse_frame_number(frames.substr(0, dots), first_frame);
+  if (dots == std::string::npos) last_frame = first_frame;
+  else if (dots+2 < frames.size()) frames_ok = frames_ok and parse_frame_number(frames.substr(dots+2), last_frame);
+  if (not frames_ok or last_frame < first_frame) {
+    std::cout << "Frame range " << frames << " is not K, K..M or K.., with 0 <= K <= M" << std::endl;
+    return 1;
+  }
 
-    if (i==0) {
-      boxszx[i] = base_size[0];
-      boxszy[i] = base_size[1];
-    } else {
-      boxszx[i] = num_per_row[i-1]*boxwid[i-1];
-      boxszy[i] = rows_needed(num_per_level[i-1],num_per_row[i-1])*boxhgt[i-1];
+  int64_t step_seconds = 0;
+  if (sacct) {
+    try {
+      step_seconds = parse_time_step(step);
+    } catch (const std::exception&) {}
+    if (step_seconds <= 0) {
+      std::cout << "Time step " << step << " is not a positive number of seconds, minutes, hours or days" << std::endl;
+      return 1;
     }
-    boxbdr[i] = block_border[i];
-    boxgap[i] = block_gap[i];
-    boxwid[i] = boxgap[i] + 2*boxbdr[i] + boxszx[i];
-    boxhgt[i] = boxgap[i] + 2*boxbdr[i] + boxszy[i];
   }
 
+  // node list can come from a copy-paste, or the output from "squeue -t running"
+  // piped straight in with "squeue -t running | switchboard -n - -o image.png"
+
   // --------------------------------------------------------------------------
-  // allocate and initialize the base image
-
-  unsigned int out_width = boxwid[nlevels-1];
-  unsigned int out_height = boxhgt[nlevels-1];
-  printf("Will create %d x %d image\n", out_width, out_height);
-  std::vector<unsigned char> base_image;
-  base_image.resize(out_width * out_height * 4);
-
-  // fill with solid white
-  const unsigned char bgcolor[4] = {255, 255, 255, 255};
-  for (unsigned int i = 0; i < out_width*out_height; i++) {
-    base_image[4*i+0] = bgcolor[0];
-    base_image[4*i+1] = bgcolor[1];
-    base_image[4*i+2] = bgcolor[2];
-    base_image[4*i+3] = bgcolor[3];
+  // load the machines and build their node number and geometry tables
+
+  std::vector<machine_t> machines(machfns.size());
+  std::string machnames;
+  std::vector<int> machnodes;
+  for (size_t m=0; m<machines.size(); ++m) {
+    if (not machines[m].load(machfns[m])) return 1;
+    machnames += (m > 0 ? "," : "") + machines[m].name;
+    machnodes.push_back(machines[m].total_num[0]);
   }
 
   // --------------------------------------------------------------------------
-  // march through all levels and draw their boxes
+  // allocate and initialize the base image of each machine
 
-  const unsigned char bdrcolor[4] = {192, 192, 192, 255};
+  std::vector<std::vector<unsigned char>> base_images;
+  for (const auto& mach : machines) base_images.push_back(draw_base_image(mach));
 
-  //for (int i=0; i<nlevels; ++i) {
-  for (int i=0; i<1; ++i) {
-    std::cout << "Drawing outlines for " << total_num[i] << " blocks at level " << i << std::endl;
+  // --------------------------------------------------------------------------
+  // prepare to draw each frame as soon as the parser completes it
 
-    if (boxbdr[i] > 0) {
+  // set drawing parameters
+  const bool overwrite_border = true;
 
-    // can add openmp here if necessary
-    for (int cnt = 0; cnt < total_num[i]; cnt++) {
+  // reset the color palette (later we will maintain it so same jobs have constant color)
+  reset_color_palette();
 
-      const int group = cnt / num_per_level[i];
-      const int igroup = group % num_per_row[i+1];
-      const int jgroup = group / num_per_row[i+1];
+  // the node-drawing kernel for each machine
+  std::vector<job_renderer_t> renderers;
+  for (const auto& mach : machines) renderers.emplace_back(mach, overwrite_border);
+
+  // with several machines, each one gets its own image, named like out_crusher.png
+  auto image_name = [&](const std::string& _frame_name, const size_t _m) {
+    if (machines.size() == 1) return _frame_name;
+    const size_t dot = (_frame_name.size() > 4 and _frame_name.compare(_frame_name.size()-4, 4, ".png") == 0)
+                     ? _frame_name.size()-4 : _frame_name.size();
+    return _frame_name.substr(0, dot) + "_" + machines[_m].name + _frame_name.substr(dot);
+  };
+
+  // the threads for parsing, and for drawing batches of frames
+  thread_pool_t pool(std::max(1, nthreads));
+
+  // a frame drawn by itself is split into bands of rows, a few for each thread
+  std::vector<int> band_rows;
+  for (size_t m=0; m<machines.size(); ++m) {
+    const int rows = (machines[m].height + 4*pool.size() - 1) / (4*pool.size());
+    band_rows.push_back(std::max(8, (rows + 7) / 8 * 8));
+    renderers[m].set_bands(band_rows.back());
+  }
 
-      const int node = cnt - group*num_per_level[i];
-      const int inode = node % num_per_row[i];
-      const int jnode = node / num_per_row[i];
+  // one image of each machine for each thread, reused for every frame
+  std::vector<std::vector<frame_buffer_t>> buffers(pool.size(), std::vector<frame_buffer_t>(machines.size()));
 
-      //std::cout << "Node " << cnt << " is " << node << " in group " << group << "\n";
-      //printf("Node %d is %d (%d x %d) in group %d (%d x %d)\n", cnt, node, inode, jnode, group, igroup, jgroup);
+  using frame_colors_t = std::vector<std::array<unsigned char,4>>;
 
-      // pixel index of top left corner
-      const int col = boxgap[2]/2  +  jgroup*boxhgt[1] + boxgap[1]/2  +  jnode*boxhgt[0] + boxgap[0]/2;
-      const int row = boxgap[2]/2  +  igroup*boxwid[1] + boxgap[1]/2  +  inode*boxwid[0] + boxgap[0]/2;
-      const int idx = col*out_width + row;
+  // the color of each job in the current frame
+  frame_colors_t colors;
 
-      // draw the top and bottom bars
-      for (int y=0; y<boxbdr[i]; ++y) {
-        const int py = idx + y*out_width;
-        for (int x=0; x<(boxszx[i]+2*boxbdr[i]); ++x) {
-          const int px = py + x;
-          for (int c=0; c<4; ++c) base_image[4*px+c] = bdrcolor[c];
-        }
-      }
-      for (int y=0; y<boxbdr[i]; ++y) {
-        const int py = idx + (y+boxbdr[i]+boxszy[i])*out_width;
-        for (int x=0; x<(boxszx[i]+2*boxbdr[i]); ++x) {
-          const int px = py + x;
-          for (int c=0; c<4; ++c) base_image[4*px+c] = bdrcolor[c];
-        }
-      }
+  // get a color for every job in a frame, in order, so that the palette sees the
+  // same sequence of jobs whether or not the frame is drawn
+  auto color_frame = [&](const frame_t& _frame) {
+    colors.resize(_frame.jobs.size());
+    for (size_t i=0; i<_frame.jobs.size(); ++i) {
 
-      // draw the sides
-      for (int y=0; y<boxszy[i]; ++y) {
-        const int py = idx + (y+boxbdr[i])*out_width;
-        for (int x=0; x<boxbdr[i]; ++x) {
-          const int px = py + x;
-          for (int c=0; c<4; ++c) base_image[4*px+c] = bdrcolor[c];
-        }
-        for (int x=0; x<boxbdr[i]; ++x) {
-          const int px = py + boxbdr[i] + boxszx[i] + x;
-          for (int c=0; c<4; ++c) base_image[4*px+c] = bdrcolor[c];
-        }
-      }
-    }
-    }
-  }
+      // check database for this jobid - return its color
+      (void) get_next_color(_frame.jobs[i].jobid, colors[i].data());
 
-  // draw a default color for every node
-  if (false) {
-    // get a color for this job
-    const unsigned char unused[4] = {231, 231, 231, 255};
-
-    // now march through all participating nodes and color their boxes
-    for (int nodeidx = 0; nodeidx < total_num[0]; nodeidx++) {
-
-      const int group = nodeidx / num_per_level[0];
-      const int igroup = group % num_per_row[1];
-      const int jgroup = group / num_per_row[1];
-      const int node = nodeidx - group*num_per_level[0];
-      const int inode = node % num_per_row[0];
-      const int jnode = node / num_per_row[0];
-
-      // pixel index of top left corner
-      const int bdr = 0;
-      const int col = boxgap[2]/2  +  jgroup*boxhgt[1] + boxgap[1]/2  +  jnode*boxhgt[0] + boxgap[0]/2 + bdr;
-      const int row = boxgap[2]/2  +  igroup*boxwid[1] + boxgap[1]/2  +  inode*boxwid[0] + boxgap[0]/2 + bdr;
-      const int idx = col*out_width + row;
-
-      // and the size of the box to draw
-      const int xwid = boxszx[0] + 2*boxbdr[0];
-      const int yhgt = boxszy[0] + 2*boxbdr[0];
-
-      // draw the block of color
-      for (int y=0; y<yhgt; ++y) {
-        const int py = idx + y*out_width;
-        for (int x=0; x<xwid; ++x) {
-          const int px = py + x;
-          for (int c=0; c<4; ++c) base_image[4*px+c] = unused[c];
-        }
-      }
+      // or always generate a new one
+      //(void) get_next_color(colors[i].data());
     }
-  }
-
-  // --------------------------------------------------------------------------
-  // repeatedly look for the keyword in the nodelist string and generate jobs
-
-  std::cout << "Parsing nodelist..." << std::endl;
-
-  // store all data in a vector of frames
-  std::vector<frame_t> frames;
-
-  // read the node list file into a single large string (could be >10MB per day)
-  std::ifstream ifs(nodefn);
-  assert (ifs.is_open() && "Could not open given node list file");
-  std::cout << "Reading nodelist..." << std::endl;
-  std::string nodelist(std::istreambuf_iterator<char>{ifs}, {});
-  ifs.close();
-
-  // start a potential new frame
-  frame_t newframe;
-
-  std::string nextframename = pngfn;
-  int nextjobid = 1;
-
-  size_t pos = 0;
-  while (pos != std::string::npos) {
-
-    // look for one of any particular search strings - or a line end
-    auto nextnodename = nodelist.find(machname, pos);
-    auto nextfilename = nodelist.find(nextfilekey, pos);
-    auto nextnewline = nodelist.find('\n', pos);
-    //std::cout << "positions of next machine " << nextnodename << " filename " << nextfilename << "  and newline " << nextnewline << std::endl;
-    // must look for a line end because then the first number on the next line must be the jobID!
-
-    if (nextfilename == nextnodename) {
-      // no more machines or files - both are npos (end of "file") - we're done
-      pos = nextfilename;
-
-    } else if (nextnewline < nextnodename and nextnewline < nextfilename) {
-      // a newline is next - read it and look for the first number on the new line
-      pos = nextnewline;
-      // advance past all whitespace
-      while (std::isspace(nodelist.at(pos))) ++pos;
-      //std::cout << "  next char is (" << nodelist.at(pos) << ")" << std::endl;
-
-      // read numbers 0..9 and build the jobid
-      int jobid = 0;
-      while (std::isdigit(nodelist.at(pos))) {
-        jobid = jobid*10 + (nodelist.at(pos) - '0');
-        ++pos;
-        if (pos == nodelist.size()) break;
-        //std::cout << ", next char is (" << nodelist.at(pos) << ")" << std::endl;
+  };
+
+  // draw and write a frame whose colors are already chosen, one image per machine,
+  // into images that hold some earlier frame, repainting only the nodes that differ;
+  // this only reads shared state, so any number of frames can be drawn at once into
+  // their own images, or one frame can be drawn with the pool, one band of rows per thread
+  auto render_frame = [&](const frame_t& _frame, const frame_colors_t& _colors, std::vector<frame_buffer_t>& _buffers,
+                          thread_pool_t* const _bands) {
+    for (size_t m=0; m<machines.size(); ++m) {
+      const std::string fn = image_name(_frame.name, m);
+      const unsigned int out_width = machines[m].width;
+      const unsigned int out_height = machines[m].height;
+      const job_renderer_t& renderer = renderers[m];
+      frame_buffer_t& fb = _buffers[m];
+
+      // the color of every node in this frame
+      renderer.start_frame(fb, base_images[m]);
+      for (size_t j=0; j<_frame.jobs.size(); ++j) {
+        if (_frame.jobs[j].machine != (int)m) continue;
+        renderer.add_job(fb, _frame.jobs[j], _colors[j].data());
       }
-      //std::cout << "  found jobid (" << jobid << ")" << std::endl;
-      nextjobid = jobid;
-      //exit(1);
+      renderer.set_palette(fb);
 
-    } else if (nextfilename < nextnodename and nextfilename < nextnewline) {
-      // next actionable keyword is a new image file name
+      // and the pixels of the ones that changed
+      if (_bands) _bands->parallel_for(renderer.num_bands(), [&](const int b) { renderer.repaint(fb, base_images[m], b); });
+      else renderer.repaint(fb, base_images[m], -1);
+      renderer.end_frame(fb);
 
-      // if there were jobs, push all of those into a new frame
-      if (not newframe.jobs.empty()) {
-        std::cout << "Finishing frame with " << newframe.jobs.size() << " jobs" << std::endl;
-        newframe.name = nextframename;
-        frames.push_back(newframe);
-
-        // clear out the temp frame's jobs list
-        newframe.jobs.clear();
-      }
-
-      pos = nextfilename;
-
-      // this is a new file name, save it until we need it
-      // advance past the substring
-      pos += nextfilekey.length();
-      // advance past all whitespace
-      while (std::isspace(nodelist.at(pos))) ++pos;
-      //std::cout << "  next char is (" << nodelist.at(pos) << ")" << std::endl;
-      // find the next non-space character
-      const size_t firstchar = pos;
-      while (not std::isspace(nodelist.at(pos))) ++pos;
-      const size_t lastchar = pos;
-      // and read the filename into a string
-      nextframename = nodelist.substr(firstchar, lastchar-firstchar);
-      std::cout << "Read filename (" << nextframename << ")" << std::endl;
+      // output to a new png
+      unsigned int error = write_png(fn, fb, out_width, out_height, band_rows[m], _bands);
+      //if there's an error, display it (all at once, since other threads may be printing)
+      if (error) std::cout << "  Encoder error " + std::to_string(error) + ": " + lodepng_error_text(error) + "\n" << std::flush;
+    }
+  };
 
+  auto announce_frame = [&](const frame_t& _frame) {
+    for (size_t m=0; m<machines.size(); ++m) {
+      std::cout << "Drawing active nodes into " << image_name(_frame.name, m) << std::endl;
+    }
+  };
+
+  // color, draw and write one frame right away
+  auto draw_frame = [&](const frame_t& _frame) {
+
+    // the colors are shared, so a job on two machines looks the same in both
+    color_frame(_frame);
+
+    announce_frame(_frame);
+    render_frame(_frame, colors, buffers[0], pool.size() > 1 ? &pool : nullptr);
+  };
+
+  // With more than one thread, frames to draw are colored in order as they arrive
+  // (the only thing one frame's drawing needs from the ones before it), then
+  // kept until there is one for every thread, and the whole batch is drawn and
+  // encoded at once. The images are the same as drawing them one at a time.
+  // What's left over at the end is drawn a frame at a time, in bands.
+  std::vector<frame_t> batch;
+  std::vector<frame_colors_t> batch_colors(pool.size());
+
+  auto draw_batch = [&]() {
+    if ((int)batch.size() == pool.size()) {
+      pool.parallel_for((int)batch.size(), [&](const int i) {
+        render_frame(batch[i], batch_colors[i], buffers[i], nullptr);
+      });
     } else {
-      // next actionable keyword is a new job, parse it
-      pos = nextnodename;
-
-      //std::cout << "found machine name at position " << pos << std::endl;
-      // advance past the substring
-      pos += machname.length();
-      //std::cout << ", next char is (" << nodelist.at(pos) << ")" << std::endl;
-      // advance only if next character is a [
-      if (nodelist.at(pos) == '[') ++pos;
-      //std::cout << ", next char is (" << nodelist.at(pos) << ")" << std::endl;
-
-      // start a potential new job
-      job_t newjob;
-      //newjob.name = "job";
-      bool keep_going = true;
-      bool is_single = true;
-
-      while (keep_going) {
-        //std::cout << "continuing to read..." << std::endl;
-
-        // quit if there's no more characters
-        if (pos == nodelist.size()) {
-          //std::cout << "  reached end of string" << std::endl;
-          keep_going = false;
-
-        // if next char is a digit, find the number
-        } else if (std::isdigit(nodelist.at(pos))) {
-          //std::cout << "  next char is digit, reading number" << std::endl;
-
-          // read numbers 0..9 and build the nodeid
-          int nodeid = 0;
-          while (std::isdigit(nodelist.at(pos))) {
-            nodeid = nodeid*10 + (nodelist.at(pos) - '0');
-            ++pos;
-            if (pos == nodelist.size()) break;
-            //std::cout << ", next char is (" << nodelist.at(pos) << ")" << std::endl;
-          }
-          if (is_single) {
-            // if we're in single mode, add this one node to the list
-            //std::cout << "  adding nodeid (" << nodeid << ")" << std::endl;
-            newjob.nodeids.push_back(map_node_name(nodeid));
-          } else {
-            // the last char was a dash, add all nodes inclusive to the list
-            auto lastnodeid = newjob.nodeids[newjob.nodeids.size()-1];
-            //std::cout << "  adding nodes " << lastnodeid+1 << " to " << map_node_name(nodeid) << std::endl;
-            for (int thisid = lastnodeid+1; thisid <= map_node_name(nodeid); ++thisid) {
-              newjob.nodeids.push_back(thisid);
-            }
-            is_single = true;
-          }
-
-        // if it's a dash, get ready to read another number
-        } else if (nodelist.at(pos) == '-') {
-          //std::cout << "  next char is dash, setting flag" << std::endl;
-          is_single = false;
-          ++pos;
-
-        // if it's a comma, get ready to read another number
-        } else if (nodelist.at(pos) == ',') {
-          //std::cout << "  next char is comma, expecting another number" << std::endl;
-          ++pos;
-
-        // and if it's a bracket, we're done
-        } else if (nodelist.at(pos) == ']') {
-          //std::cout << "  next char is bracket, we're done with this entry" << std::endl;
-          keep_going = false;
-          ++pos;
-
-        } else {
-          keep_going = false;
-        }
-      } // end while (keep_going)
-
-      // add to list
-      std::cout << "  adding job " << nextjobid << " with " << newjob.nodeids.size() << " nodes" << std::endl;
-      newjob.jobid = nextjobid;
-      newframe.jobs.push_back(newjob);
-
-      // increment jobid in case it isn't given
-      nextjobid++;
-
-    } // end adding job
+      for (size_t i=0; i<batch.size(); ++i) render_frame(batch[i], batch_colors[i], buffers[0], &pool);
+    }
+    batch.clear();
+  };
+
+  auto queue_frame = [&](frame_t&& _frame) {
+    color_frame(_frame);
+    announce_frame(_frame);
+    batch_colors[batch.size()].swap(colors);
+    batch.push_back(std::move(_frame));
+    if ((int)batch.size() == pool.size()) draw_batch();
+  };
+
+  // optionally save every parsed frame for quick re-rendering
+  std::unique_ptr<frame_cache_writer_t> cache;
+  if (not cachefn.empty()) {
+    cache = std::make_unique<frame_cache_writer_t>(cachefn, machnames, machnodes);
+    assert (cache->is_open() && "Could not open frame cache file for writing");
   }
 
-  // put whatever's on the stack into the last/only frame
-  std::cout << "Finishing last frame with " << newframe.jobs.size() << " jobs" << std::endl;
-  newframe.name = nextframename;
-  frames.push_back(newframe);
+  // optionally note where every frame starts, for jumping into the nodelist later
+  std::unique_ptr<frame_index_writer_t> index;
+  if (not writeindexfn.empty()) {
+    index = std::make_unique<frame_index_writer_t>(writeindexfn, index_stride);
+    assert (index->is_open() && "Could not open frame index file for writing");
+  }
 
-  // --------------------------------------------------------------------------
-  // march through active frames and jobs and draw them
+  // the number of the next frame to finish, and the parser to stop after the last one
+  int nframe = 0;
+  nodelist_parser_t* active_parser = nullptr;
 
-  // set drawing parameters
-  const bool overwrite_border = true;
+  // the parser hands over each frame once it's complete
+  auto finish_frame = [&](frame_t&& _frame) {
+    if (nframe > last_frame) return;
 
-  // reset the color palette (later we will maintain it so same jobs have constant color)
-  reset_color_palette();
+    if (index) index->add(_frame);
+    if (cache) cache->write(_frame);
 
-  // loop over all frames in vector
-  for (auto frame : frames) {
+    // frames that aren't drawn still need their colors picked, but never decode their hostlists
+    if (nframe < first_frame or (nframe - first_frame) % every != 0) color_frame(_frame);
+    else if (pool.size() > 1) queue_frame(std::move(_frame));
+    else draw_frame(_frame);
 
-    // prepare the new output image as a copy of the baseline image
-    std::vector<unsigned char> out_image = base_image;
+    // "age" each of the colors by 1
+    age_all_colors();
 
-    std::cout << "Drawing active nodes into " << frame.name << std::endl;
-    for (auto job : frame.jobs) {
+    if (++nframe > last_frame and active_parser) active_parser->stop();
 
-      // get a color for this job
-      std::array<unsigned char,4> color;
+    // and the frame (with all of its node lists) is dropped when we return
+  };
 
-      // check database for this jobid - return its color
-      (void) get_next_color(job.jobid, color.data());
+  // --------------------------------------------------------------------------
+  // scan the nodelist once, drawing each frame as soon as it is complete
 
-      // or always generate a new one
-      //(void) get_next_color(color);
-
-      // now march through all participating nodes and color their boxes
-      for (auto nodeid : job.nodeids) {
-
-        // convert node name/number to 0-index (already done!)
-        const int nodeidx = nodeid;
-
-        if (nodeidx < 0) continue;
-
-        const int group = nodeidx / num_per_level[0];
-        const int igroup = group % num_per_row[1];
-        const int jgroup = group / num_per_row[1];
-        const int node = nodeidx - group*num_per_level[0];
-        const int inode = node % num_per_row[0];
-        const int jnode = node / num_per_row[0];
-
-        // pixel index of top left corner
-        const int bdr = (overwrite_border ? 0 : boxbdr[0]);
-        const int col = boxgap[2]/2  +  jgroup*boxhgt[1] + boxgap[1]/2  +  jnode*boxhgt[0] + boxgap[0]/2 + bdr;
-        const int row = boxgap[2]/2  +  igroup*boxwid[1] + boxgap[1]/2  +  inode*boxwid[0] + boxgap[0]/2 + bdr;
-        const int idx = col*out_width + row;
-
-        // and the size of the box to draw
-        const int xwid = boxszx[0] + (overwrite_border ? 2*boxbdr[0] : 0);
-        const int yhgt = boxszy[0] + (overwrite_border ? 2*boxbdr[0] : 0);
-
-        // draw the block of color
-        for (int y=0; y<yhgt; ++y) {
-          const int py = idx + y*out_width;
-          for (int x=0; x<xwid; ++x) {
-            const int px = py + x;
-            for (int c=0; c<4; ++c) out_image[4*px+c] = color[c];
-          }
-        }
+  // open the node list: a file (could be >10MB per day, or much more for archives) or "-" for stdin
+  std::cout << "Reading nodelist..." << std::endl;
+  input_file_t nodelist(nodefn, follow);
+  assert (nodelist.is_open() && "Could not open given node list file");
+
+  std::cout << "Parsing nodelist..." << std::endl;
+  const char* first;
+  const char* last;
+
+  if (sacct) {
+    // job records with start and end times: read them all, then sweep over time
+    sacct_timeline_t timeline(machines);
+    while (nodelist.next(first, last)) timeline.feed(first, last);
+    const std::string stem = pngfn.size() > 4 and pngfn.compare(pngfn.size()-4, 4, ".png") == 0
+                           ? pngfn.substr(0, pngfn.size()-4) : pngfn;
+    timeline.finish(step_seconds, stem, finish_frame);
+
+  } else if (nodelist.whole(first, last) and is_frame_cache(first, last)) {
+    // frames were parsed and saved by an earlier run, just draw them
+    if (not read_frame_cache(first, last, machnames, machnodes, finish_frame)) return 1;
+
+  } else if (follow) {
+    // parse whatever is there, then only the bytes appended after that, for as
+    // long as the file exists; the color palette lives on between updates
+    nodelist_parser_t parser(machines, pngfn, finish_frame);
+    do {
+      bool grew = false;
+      while (nodelist.next(first, last)) {
+        parser.feed(first, last);
+        grew = true;
+      }
+
+      // the newest frame isn't finished until the next file keyword arrives, but draw
+      // what it has now so its image is current; this picks the same colors that
+      // drawing it once at the end would, and only the finished frame ages them
+      draw_batch();
+      if (grew and not parser.current().jobs.empty()) draw_frame(parser.current());
+
+      std::cout << "Waiting for more nodelist..." << std::endl;
+    } while (nodelist.wait_for_more());
+    parser.finish();
+
+  } else if (first_frame > 0 or last_frame < std::numeric_limits<int>::max()) {
+    // a range of frames: parse serially so that we can jump in and stop early
+    nodelist_parser_t parser(machines, pngfn, finish_frame);
+    active_parser = &parser;
+
+    if (not indexfn.empty() and nodelist.whole(first, last)) {
+      // start from the last checkpoint before the first wanted frame
+      const auto entries = read_frame_index(indexfn);
+      const int k = find_checkpoint(entries, first_frame);
+      if (k >= 0 and not index_entry_matches(entries[k], first, last)) {
+        std::cout << "Frame index " << indexfn << " does not match this nodelist, reading it from the start" << std::endl;
+      } else if (k >= 0) {
+        std::cout << "Jumping to frame " << k << " at byte " << entries[k].offset << std::endl;
+        set_color_state(*entries[k].colors);
+        nframe = k;
+        parser.resume_at(entries[k].offset, entries[k].jobid);
+        nodelist.release(first + entries[k].offset);
+        nodelist.skip_to(entries[k].offset);
       }
     }
 
-    // output to a new png
-    unsigned int error = lodepng::encode(frame.name.c_str(), out_image, out_width, out_height);
-    //if there's an error, display it
-    if (error) std::cout << "  Encoder error " << error << ": "<< lodepng_error_text(error) << std::endl;
+    while (nframe <= last_frame and nodelist.next(first, last)) parser.feed(first, last);
+    parser.finish();
 
-    // "age" each of the colors by 1
-    age_all_colors();
+  } else if (pool.size() > 1 and nodelist.whole(first, last)) {
+    // parse pieces of a large file on all threads, drawing frames in order as they come
+    parse_in_parallel(first, last, pool, machines, pngfn, finish_frame,
+                      [&nodelist](const char* _upto) { nodelist.release(_upto); });
+
+  } else {
+    // feed the text piece by piece as it is mapped or arrives, so that memory
+    // use stays near one frame and one image for any input size
+    nodelist_parser_t parser(machines, pngfn, finish_frame);
+    while (nodelist.next(first, last)) parser.feed(first, last);
+    parser.finish();
   }
-}
 
+  // and any frames still waiting to be drawn
+  draw_batch();
+}
@@ -11,24 +11,75 @@
 
 #include <vector>
 #include <string>
+#include <memory>
+#include <mutex>
+
+// an inclusive range of 0-indexed node ids
+struct node_range_t {
+  int first;
+  int last;
+};
+
+// sorted, non-overlapping and non-adjacent
+using node_set_t = std::vector<node_range_t>;
+
+// node numbers (as written in hostlists) to 0-indexed, continuous node ids, with
+// -1 for numbers that aren't nodes; built from a machine description (machine.h)
+struct node_map_t {
+  std::vector<int> index;
+
+  // the runs of node numbers that were numbered in order, sorted by number: ids
+  // only count up along with the numbers within a run, so a range of numbers in
+  // a hostlist is a range of ids inside each run it crosses
+  std::vector<node_range_t> runs;
+
+  // for machines whose hosts are named by Cray xname (x1000c0s0b0n0): how many
+  // chassis per cabinet, slots per chassis, boards per slot and nodes per board;
+  // then index numbers the cabinets instead, and node ids count through the fields
+  bool xname = false;
+  int xname_count[4] = {0, 0, 0, 0};
+
+  int operator()(const int _n) const {
+    return (_n >= 0 and _n < (int)index.size()) ? index[_n] : -1;
+  }
+};
+
+// the nodes of one hostlist: either given already decoded, or kept as the hostlist
+// text and decoded (once, from any thread) when they are first wanted, so that
+// frames which are never drawn never pay for decoding
+struct hostlist_t {
+  hostlist_t(node_set_t _nodes) : set(std::move(_nodes)) {
+    std::call_once(decoded, []{});
+  }
+  hostlist_t(const char* _first, const char* _last, const node_map_t& _map)
+    : text(_first, _last), map(&_map) {}
+
+  const node_set_t& nodes() const;	// see hostlist.h
+
+  const std::string text;		// after the machine name, like "[00002-00054,00056]" or "1000c0s[0-7]b0n0"
+
+private:
+  const node_map_t* map = nullptr;
+  mutable std::once_flag decoded;
+  mutable node_set_t set;
+};
 
 struct job_t {
   //std::string name;
   int jobid;
-  std::vector<int> nodeids;
+  int machine = 0;				// which of the machines being drawn
+  std::shared_ptr<const hostlist_t> hostlist;	// shared by every frame with this same hostlist
+
+  const node_set_t& nodes() const { return hostlist->nodes(); }
 };
 
 struct frame_t {
   std::string name;
   std::vector<job_t> jobs;
+  // where this frame starts in the text input, and the next jobid at that point
+  size_t offset = 0;
+  int offset_jobid = 1;
 };
 
-//struct machine_t {
-  // the machine name to search for
-  //std::string name;
-  // the node hierarchy
-  // a mapping function from node name to 0-indexed id
-//};
-
 const std::string nextfilekey = "file";		// keyword to look for to start a new file
 
@@ -0,0 +1,103 @@
+//
+// thread_pool.h
+//
+// A fixed set of worker threads for running loops in parallel
+//
+// (c)2023 Mark J Stock <markjstock@gmail.com>
+//
+
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+// Workers are started once and then sleep between calls to parallel_for;
+// the calling thread also takes iterations, so a pool of 1 runs inline
+struct thread_pool_t {
+
+  thread_pool_t(const int _nthreads) {
+    for (int i=1; i<_nthreads; ++i) workers.emplace_back([this] { work(); });
+  }
+
+  ~thread_pool_t() {
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      quit = true;
+    }
+    wake.notify_all();
+    for (auto& w : workers) w.join();
+  }
+
+  thread_pool_t(const thread_pool_t&) = delete;
+  thread_pool_t& operator=(const thread_pool_t&) = delete;
+
+  int size() const { return (int)workers.size() + 1; }
+
+  // call _fn(i) for every i in [0,_n), in any order, and return when all are done
+  void parallel_for(const int _n, const std::function<void(int)>& _fn) {
+    if (workers.empty() or _n < 2) {
+      for (int i=0; i<_n; ++i) _fn(i);
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      task = &_fn;
+      ntasks = _n;
+      next = 0;
+      nbusy = (int)workers.size();
+      ++generation;
+    }
+    wake.notify_all();
+
+    run_tasks(_fn, _n);
+
+    // wait for the workers to finish their last iterations
+    std::unique_lock<std::mutex> lock(mtx);
+    done.wait(lock, [this] { return nbusy == 0; });
+    task = nullptr;
+  }
+
+private:
+  void run_tasks(const std::function<void(int)>& _fn, const int _n) {
+    for (int i = next++; i < _n; i = next++) _fn(i);
+  }
+
+  void work() {
+    unsigned int seen = 0;
+    while (true) {
+      const std::function<void(int)>* fn;
+      int n;
+      {
+        std::unique_lock<std::mutex> lock(mtx);
+        wake.wait(lock, [&] { return quit or generation != seen; });
+        if (quit) return;
+        seen = generation;
+        fn = task;
+        n = ntasks;
+      }
+
+      run_tasks(*fn, n);
+
+      {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (--nbusy == 0) done.notify_one();
+      }
+    }
+  }
+
+  std::vector<std::thread> workers;
+  std::mutex mtx;
+  std::condition_variable wake;
+  std::condition_variable done;
+  const std::function<void(int)>* task = nullptr;
+  int ntasks = 0;
+  std::atomic<int> next{0};
+  int nbusy = 0;
+  unsigned int generation = 0;
+  bool quit = false;
+};